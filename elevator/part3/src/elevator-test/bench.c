@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "wrappers.h"
+#include "ring.h"
+#include "params.h"
+
+// Drives the elevator with one or more load shapes and reports latency
+// percentiles. Wait and ride times come from the event ring, so they are in
+// the module's simulated time; issue_request latency is wall time.
+
+#define TRACKED_PETS 65536
+#define LOBBY 1
+
+enum load {
+	LOAD_POISSON,  // uniform origin and destination
+	LOAD_UPPEAK,   // morning: mostly from the lobby up
+	LOAD_DOWNPEAK, // evening: mostly down to the lobby
+	LOAD_INTERFLOOR, // between floors above the lobby
+	NR_LOADS,
+};
+
+const char *load_names[NR_LOADS] = { "poisson", "uppeak", "downpeak", "interfloor" };
+
+struct samples {
+	__u64 *ns;
+	size_t n, cap;
+};
+
+struct bench {
+	enum load load;
+	double rate; // pets per second, over all threads
+	double duration; // seconds of arrivals
+	double drain; // seconds to wait for the last deliveries
+	int threads;
+	int floors;
+	int types;
+};
+
+struct producer_arg {
+	struct bench *b;
+	unsigned int seed;
+	struct timespec start;
+	long issued;
+	long failed;
+	long rejected; // failed with EAGAIN: the module's queues were full
+	struct samples issue_ns;
+};
+
+struct pet_times {
+	__u64 id;
+	__u64 enqueue_ns;
+	__u64 board_ns;
+};
+
+// Event ring follower state, shared with the main thread through
+// __atomic loads of the counters.
+struct follower {
+	struct elevator_ring_header *hdr;
+	volatile int stop;
+	__u64 delivered;
+	__u64 lost;
+	__u64 first_ns, last_ns; // first enqueue and last drop-off seen
+	struct samples wait_ns, ride_ns;
+	struct pet_times pets[TRACKED_PETS];
+};
+
+__u64 now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int add_sample(struct samples *s, __u64 ns) {
+	if (s->n == s->cap) {
+		size_t cap = s->cap ? s->cap * 2 : 4096;
+		__u64 *grown = realloc(s->ns, cap * sizeof(*grown));
+
+		if (!grown)
+			return -1;
+		s->ns = grown;
+		s->cap = cap;
+	}
+	s->ns[s->n++] = ns;
+	return 0;
+}
+
+int cmp_u64(const void *a, const void *b) {
+	__u64 x = *(const __u64 *)a, y = *(const __u64 *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Nearest-rank percentile of sorted samples.
+__u64 percentile(struct samples *s, double p) {
+	size_t rank;
+
+	if (!s->n)
+		return 0;
+	rank = (size_t)ceil(p / 100 * s->n);
+	return s->ns[rank ? rank - 1 : 0];
+}
+
+// Prints name_p50..name_max in unit (ns divided by div).
+void print_percentiles(const char *name, struct samples *s, const char *unit, double div) {
+	qsort(s->ns, s->n, sizeof(*s->ns), cmp_u64);
+	printf("%s_p50_%s: %.3f\n", name, unit, percentile(s, 50) / div);
+	printf("%s_p95_%s: %.3f\n", name, unit, percentile(s, 95) / div);
+	printf("%s_p99_%s: %.3f\n", name, unit, percentile(s, 99) / div);
+	printf("%s_max_%s: %.3f\n", name, unit, s->n ? s->ns[s->n - 1] / div : 0);
+}
+
+int rnd_r(unsigned int *seed, int min, int max) {
+	return rand_r(seed) % (max - min + 1) + min;
+}
+
+int other_floor(unsigned int *seed, int min, int max, int floor) {
+	int f;
+
+	do {
+		f = rnd_r(seed, min, max);
+	} while (f == floor);
+	return f;
+}
+
+// Nine in ten pets of a peak go to or from the lobby, the rest move
+// between random floors.
+void make_request(struct bench *b, unsigned int *seed, struct pet_request *req) {
+	int top = b->floors;
+	int peak = rnd_r(seed, 0, 9) != 0;
+
+	req->type = rnd_r(seed, 0, b->types - 1);
+	switch (b->load) {
+	case LOAD_UPPEAK:
+		req->start_floor = peak ? LOBBY : rnd_r(seed, 1, top);
+		break;
+	case LOAD_DOWNPEAK:
+		req->start_floor = peak ? rnd_r(seed, LOBBY + 1, top) : rnd_r(seed, 1, top);
+		break;
+	case LOAD_INTERFLOOR:
+		if (top > 2) {
+			req->start_floor = rnd_r(seed, LOBBY + 1, top);
+			req->destination_floor = other_floor(seed, LOBBY + 1, top, req->start_floor);
+			return;
+		}
+		/* fall through */
+	default:
+		req->start_floor = rnd_r(seed, 1, top);
+		break;
+	}
+	if (b->load == LOAD_DOWNPEAK && peak)
+		req->destination_floor = LOBBY;
+	else if (b->load == LOAD_UPPEAK && peak)
+		req->destination_floor = rnd_r(seed, LOBBY + 1, top);
+	else
+		req->destination_floor = other_floor(seed, 1, top, req->start_floor);
+}
+
+void timespec_add(struct timespec *ts, double sec) {
+	long ns = ts->tv_nsec + (long)(sec * 1e9);
+
+	ts->tv_sec += ns / 1000000000L;
+	ts->tv_nsec = ns % 1000000000L;
+}
+
+// Poisson arrivals: each thread carries rate / threads with exponential
+// gaps, sleeping to absolute times so issue latency does not skew the rate.
+void *producer_thread(void *data) {
+	struct producer_arg *arg = data;
+	struct bench *b = arg->b;
+	double rate = b->rate / b->threads;
+	struct timespec next = arg->start;
+	double elapsed = 0;
+
+	for (;;) {
+		struct pet_request req;
+		double u = (rand_r(&arg->seed) + 1.0) / ((double)RAND_MAX + 2.0);
+		double gap = -log(u) / rate;
+		__u64 t0;
+		long ret;
+
+		elapsed += gap;
+		if (elapsed >= b->duration)
+			break;
+		timespec_add(&next, gap);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		make_request(b, &arg->seed, &req);
+		t0 = now_ns();
+		ret = issue_request(req.start_floor, req.destination_floor, req.type);
+		add_sample(&arg->issue_ns, now_ns() - t0);
+		arg->issued++;
+		if (ret != 0)
+			arg->failed++;
+		if (ret < 0 && errno == EAGAIN)
+			arg->rejected++;
+	}
+	return NULL;
+}
+
+// Follows the event ring and turns enqueue/board/dispense triples into
+// wait and ride samples.
+void *follower_thread(void *data) {
+	struct follower *f = data;
+	struct timespec idle = { 0, 1000 * 1000 };
+	struct elevator_event ev;
+	__u64 pos = __atomic_load_n(&f->hdr->head, __ATOMIC_RELAXED) + 1;
+
+	while (!f->stop) {
+		int ret = read_event(f->hdr, pos, &ev);
+		struct pet_times *pt;
+
+		if (ret == 0) {
+			nanosleep(&idle, NULL);
+			continue;
+		}
+		if (ret < 0) {
+			__u64 oldest = __atomic_load_n(&f->hdr->head, __ATOMIC_RELAXED) - f->hdr->nr_events + 1;
+			__atomic_add_fetch(&f->lost, oldest > pos ? oldest - pos : 1, __ATOMIC_RELAXED);
+			pos = oldest > pos ? oldest : pos + 1;
+			continue;
+		}
+		pos++;
+
+		pt = &f->pets[ev.pet_id % TRACKED_PETS];
+		switch (ev.type) {
+		case ELEVATOR_EV_ENQUEUE:
+			pt->id = ev.pet_id;
+			pt->enqueue_ns = ev.time_ns;
+			pt->board_ns = 0;
+			if (!f->first_ns)
+				f->first_ns = ev.time_ns;
+			break;
+		case ELEVATOR_EV_BOARD:
+			if (pt->id == ev.pet_id)
+				pt->board_ns = ev.time_ns;
+			break;
+		case ELEVATOR_EV_DISPENSE:
+			if (pt->id == ev.pet_id && pt->board_ns) {
+				add_sample(&f->wait_ns, pt->board_ns - pt->enqueue_ns);
+				add_sample(&f->ride_ns, ev.time_ns - pt->board_ns);
+				f->last_ns = ev.time_ns;
+				__atomic_add_fetch(&f->delivered, 1, __ATOMIC_RELEASE);
+			}
+			pt->id = 0;
+			break;
+		}
+	}
+	return NULL;
+}
+
+int run_load(struct bench *b, struct elevator_ring_header *hdr, unsigned int seed) {
+	struct producer_arg *args = calloc(b->threads, sizeof(*args));
+	pthread_t *tids = calloc(b->threads, sizeof(*tids));
+	struct follower *f = calloc(1, sizeof(*f));
+	struct samples issue_ns = { 0 };
+	struct timespec drain_poll = { 0, 10 * 1000 * 1000 };
+	pthread_t follower;
+	long issued = 0, failed = 0, rejected = 0;
+	double start, deadline;
+	char version[64];
+	int i;
+
+	if (!args || !tids || !f) {
+		printf("out of memory\n");
+		return -1;
+	}
+
+	f->hdr = hdr;
+	pthread_create(&follower, NULL, follower_thread, f);
+
+	start = now_sec();
+	for (i = 0; i < b->threads; i += 1) {
+		args[i].b = b;
+		args[i].seed = seed + i;
+		clock_gettime(CLOCK_MONOTONIC, &args[i].start);
+		pthread_create(&tids[i], NULL, producer_thread, &args[i]);
+	}
+	for (i = 0; i < b->threads; i += 1) {
+		pthread_join(tids[i], NULL);
+		issued += args[i].issued;
+		failed += args[i].failed;
+		rejected += args[i].rejected;
+	}
+
+	// Pets still in the building when the arrivals stop are waited for,
+	// up to the drain limit.
+	deadline = now_sec() + b->drain;
+	while (__atomic_load_n(&f->delivered, __ATOMIC_ACQUIRE) + __atomic_load_n(&f->lost, __ATOMIC_RELAXED) <
+	       (__u64)(issued - failed) && now_sec() < deadline)
+		nanosleep(&drain_poll, NULL);
+	f->stop = 1;
+	pthread_join(follower, NULL);
+
+	for (i = 0; i < b->threads; i += 1) {
+		size_t j;
+
+		for (j = 0; j < args[i].issue_ns.n; j += 1)
+			add_sample(&issue_ns, args[i].issue_ns.ns[j]);
+		free(args[i].issue_ns.ns);
+	}
+
+	if (read_line(PARAM_DIR "version", version, sizeof(version)))
+		snprintf(version, sizeof(version), "unknown");
+	printf("load: %s\n", load_names[b->load]);
+	printf("module_version: %s\n", version);
+	printf("floors: %d\n", b->floors);
+	printf("threads: %d\n", b->threads);
+	printf("rate: %.3f\n", b->rate);
+	printf("duration_s: %.3f\n", b->duration);
+	printf("elapsed_s: %.3f\n", now_sec() - start);
+	printf("requests: %ld\n", issued);
+	printf("failed: %ld\n", failed);
+	printf("rejected: %ld\n", rejected);
+	printf("delivered: %llu\n", (unsigned long long)f->delivered);
+	printf("events_lost: %llu\n", (unsigned long long)f->lost);
+	print_percentiles("issue", &issue_ns, "us", 1e3);
+	print_percentiles("wait", &f->wait_ns, "ms", 1e6);
+	print_percentiles("ride", &f->ride_ns, "ms", 1e6);
+	printf("pets_per_min: %.3f\n", f->last_ns > f->first_ns ?
+	       f->delivered * 60e9 / (f->last_ns - f->first_ns) : 0);
+
+	free(issue_ns.ns);
+	free(f->wait_ns.ns);
+	free(f->ride_ns.ns);
+	free(f);
+	free(tids);
+	free(args);
+	return 0;
+}
+
+void usage(void) {
+	printf("usage: bench [-l load[,load...]] [-r pets_per_sec] [-d seconds] [-t threads]\n"
+	       "             [-w drain_seconds] [-s seed]\n"
+	       "loads: poisson uppeak downpeak interfloor (default: all)\n");
+}
+
+int main(int argc, char **argv) {
+	struct bench b = {
+		.rate = 1,
+		.duration = 60,
+		.drain = 600,
+		.threads = 1,
+	};
+	struct elevator_ring_header *hdr;
+	char *loads = NULL;
+	unsigned int seed = time(0);
+	char *name, *cur;
+	size_t size;
+	int first = 1;
+	int fd;
+	int c;
+
+	while ((c = getopt(argc, argv, "l:r:d:t:w:s:h")) != -1) {
+		switch (c) {
+		case 'l': loads = strdup(optarg); break;
+		case 'r': b.rate = atof(optarg); break;
+		case 'd': b.duration = atof(optarg); break;
+		case 't': b.threads = atoi(optarg); break;
+		case 'w': b.drain = atof(optarg); break;
+		case 's': seed = strtoul(optarg, NULL, 0); break;
+		default:
+			usage();
+			return c == 'h' ? 0 : -1;
+		}
+	}
+	if (optind != argc || b.rate <= 0 || b.duration <= 0 || b.threads < 1) {
+		usage();
+		return -1;
+	}
+	if (!loads)
+		loads = strdup("poisson,uppeak,downpeak,interfloor");
+	b.floors = param_int("floors", 5);
+	b.types = param_types(4);
+
+	fd = open(ELEVATOR_EVENTS_DEV, O_RDONLY);
+	if (fd < 0) {
+		perror(ELEVATOR_EVENTS_DEV);
+		return -1;
+	}
+	hdr = map_ring(fd, &size);
+	if (!hdr) {
+		perror("mmap");
+		return -1;
+	}
+
+	// One block of results per load, separated by a blank line.
+	for (cur = loads; (name = strsep(&cur, ",")) != NULL;) {
+		int i;
+
+		for (i = 0; i < NR_LOADS; i += 1)
+			if (strcmp(name, load_names[i]) == 0)
+				break;
+		if (i == NR_LOADS) {
+			printf("unknown load %s\n", name);
+			return -1;
+		}
+		b.load = i;
+		if (!first)
+			printf("\n");
+		first = 0;
+		if (run_load(&b, hdr, seed))
+			return -1;
+	}
+
+	munmap(hdr, size);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "ring.h"
+#include "params.h"
+
+// Pets are matched to their earlier events by id modulo this many slots.
+#define TRACKED_PETS 65536
+
+struct pet_times {
+	__u64 id;
+	__u64 enqueue_ns;
+	__u64 board_ns;
+};
+
+static volatile sig_atomic_t done;
+static struct pet_times pets[TRACKED_PETS];
+static char letters[32];
+static int nr_letters;
+
+void on_signal(int sig) {
+	done = 1;
+}
+
+// The letters are read once at startup, so a type added by a later
+// start_elevator shows as '?'.
+char pet_letter(int type) {
+	return type >= 0 && type < nr_letters ? letters[type] : '?';
+}
+
+int main(int argc, char **argv) {
+	struct elevator_ring_header *hdr;
+	struct elevator_event ev;
+	struct timespec idle = { 0, 10 * 1000 * 1000 };
+	unsigned long long serviced = 0, lost = 0;
+	double total_wait = 0, total_ride = 0;
+	size_t size;
+	__u64 pos;
+	int quiet = argc == 2 && strcmp(argv[1], "--quiet") == 0;
+	int fd;
+
+	if (argc > 2 || (argc == 2 && !quiet)) {
+		printf("usage: events [--quiet]\n");
+		return -1;
+	}
+	nr_letters = param_letters(letters, sizeof(letters));
+
+	fd = open(ELEVATOR_EVENTS_DEV, O_RDONLY);
+	if (fd < 0) {
+		perror(ELEVATOR_EVENTS_DEV);
+		return -1;
+	}
+	hdr = map_ring(fd, &size);
+	if (!hdr) {
+		perror("mmap");
+		return -1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	// Start with the next event written; older ones may already be gone.
+	pos = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED) + 1;
+	while (!done) {
+		int ret = read_event(hdr, pos, &ev);
+		struct pet_times *pt;
+
+		if (ret == 0) {
+			nanosleep(&idle, NULL);
+			continue;
+		}
+		if (ret < 0) {
+			__u64 oldest = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED) - hdr->nr_events + 1;
+			lost += oldest > pos ? oldest - pos : 1;
+			pos = oldest > pos ? oldest : pos + 1;
+			continue;
+		}
+		pos++;
+
+		pt = &pets[ev.pet_id % TRACKED_PETS];
+		switch (ev.type) {
+		case ELEVATOR_EV_ENQUEUE:
+			pt->id = ev.pet_id;
+			pt->enqueue_ns = ev.time_ns;
+			pt->board_ns = 0;
+			break;
+		case ELEVATOR_EV_BOARD:
+			if (pt->id == ev.pet_id)
+				pt->board_ns = ev.time_ns;
+			break;
+		case ELEVATOR_EV_DISPENSE:
+			if (pt->id == ev.pet_id && pt->board_ns) {
+				double wait = (pt->board_ns - pt->enqueue_ns) / 1e9;
+				double ride = (ev.time_ns - pt->board_ns) / 1e9;
+
+				serviced++;
+				total_wait += wait;
+				total_ride += ride;
+				if (!quiet)
+					printf("pet %llu %c -> %d wait %.3f s ride %.3f s\n",
+					       (unsigned long long)ev.pet_id, pet_letter(ev.pet_type),
+					       ev.dest, wait, ride);
+			}
+			pt->id = 0;
+			break;
+		}
+	}
+
+	printf("pets serviced: %llu\n", serviced);
+	printf("average wait: %.3f s\n", serviced ? total_wait / serviced : 0);
+	printf("average ride: %.3f s\n", serviced ? total_ride / serviced : 0);
+	printf("events lost: %llu\n", lost);
+
+	munmap(hdr, size);
+	close(fd);
+	return 0;
+}
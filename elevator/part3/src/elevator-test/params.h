@@ -0,0 +1,76 @@
+#ifndef __PARAMS_H
+#define __PARAMS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// The module's sysfs directory and the helpers the test programs use to
+// read its parameters.
+#define PARAM_DIR "/sys/module/elevator/"
+
+double now_sec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// First line of a sysfs file, without the newline.
+int read_line(const char *path, char *buf, size_t size) {
+	FILE *f = fopen(path, "r");
+
+	if (!f)
+		return -1;
+	if (!fgets(buf, size, f))
+		buf[0] = '\0';
+	fclose(f);
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+int read_param(const char *name, char *buf, size_t size) {
+	char path[128];
+
+	snprintf(path, sizeof(path), PARAM_DIR "parameters/%s", name);
+	return read_line(path, buf, size);
+}
+
+// Parameters fall back to the module defaults when it is not loaded.
+int param_int(const char *name, int def) {
+	char buf[64];
+
+	return read_param(name, buf, sizeof(buf)) ? def : atoi(buf);
+}
+
+// Number of letter:weight entries in pet_types.
+int param_types(int def) {
+	char buf[256];
+	int n = 1;
+	char *c;
+
+	if (read_param("pet_types", buf, sizeof(buf)) || !buf[0])
+		return def;
+	for (c = buf; *c; c++)
+		n += *c == ',';
+	return n;
+}
+
+// Letters of the pet types from pet_types, in type order, or the module
+// defaults when it is not loaded. Returns how many there are.
+int param_letters(char *letters, int size) {
+	char buf[256];
+	char *entry, *save;
+	int n = 0;
+
+	if (read_param("pet_types", buf, sizeof(buf)) || !buf[0])
+		snprintf(buf, sizeof(buf), "C:3,P:14,H:10,D:16");
+	for (entry = strtok_r(buf, ",", &save); entry && n < size - 1; entry = strtok_r(NULL, ",", &save)) {
+		entry += strspn(entry, " \t");
+		letters[n++] = entry[0];
+	}
+	letters[n] = '\0';
+	return n;
+}
+
+#endif
@@ -1,25 +1,141 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
 #include "wrappers.h"
 
 int rnd(int min, int max) {
 	return rand() % (max - min + 1) + min; //slight bias towards first k
 }
 
+int rnd_r(unsigned int *seed, int min, int max) {
+	return rand_r(seed) % (max - min + 1) + min;
+}
+
+struct producer_arg {
+	int num;
+	int batch;
+	unsigned int seed;
+	long failed;
+};
+
+double now_sec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void random_request(unsigned int *seed, struct pet_request *req) {
+	req->type = rnd_r(seed, 0, 3);
+	req->start_floor = rnd_r(seed, 1, 5);
+	do {
+		req->destination_floor = rnd_r(seed, 1, 5);
+	} while (req->destination_floor == req->start_floor);
+}
+
+void *producer_thread(void *data) {
+	struct producer_arg *arg = data;
+	struct pet_request req;
+	int i;
+
+	for (i = 0; i < arg->num; i += 1) {
+		random_request(&arg->seed, &req);
+		if (issue_request(req.start_floor, req.destination_floor, req.type) != 0)
+			arg->failed++;
+	}
+	return NULL;
+}
+
+// Same load as producer_thread, submitted arg->batch requests per syscall.
+void *batch_producer_thread(void *data) {
+	struct producer_arg *arg = data;
+	struct pet_request *reqs = calloc(arg->batch, sizeof(*reqs));
+	int done = 0;
+	int i;
+
+	if (!reqs) {
+		arg->failed = arg->num;
+		return NULL;
+	}
+	while (done < arg->num) {
+		int n = arg->num - done < arg->batch ? arg->num - done : arg->batch;
+		int ret;
+
+		for (i = 0; i < n; i += 1)
+			random_request(&arg->seed, &reqs[i]);
+		ret = issue_requests(reqs, n);
+		arg->failed += ret < 0 ? n : n - ret;
+		done += n;
+	}
+	free(reqs);
+	return NULL;
+}
+
+// Issue num requests split across threads and report request throughput.
+// A batch size above 1 submits through issue_requests instead.
+int run_benchmark(int num, int threads, int batch) {
+	pthread_t *tids = calloc(threads, sizeof(*tids));
+	struct producer_arg *args = calloc(threads, sizeof(*args));
+	long failed = 0;
+	double start, elapsed;
+	int i;
+
+	if (!tids || !args) {
+		printf("out of memory\n");
+		return -1;
+	}
+
+	start = now_sec();
+	for (i = 0; i < threads; i += 1) {
+		args[i].num = num / threads + (i < num % threads);
+		args[i].batch = batch;
+		args[i].seed = time(0) + i;
+		pthread_create(&tids[i], NULL, batch > 1 ? batch_producer_thread : producer_thread, &args[i]);
+	}
+	for (i = 0; i < threads; i += 1) {
+		pthread_join(tids[i], NULL);
+		failed += args[i].failed;
+	}
+	elapsed = now_sec() - start;
+
+	printf("threads: %d\n", threads);
+	printf("batch: %d\n", batch);
+	printf("requests: %d\n", num);
+	printf("failed: %ld\n", failed);
+	printf("elapsed: %.6f s\n", elapsed);
+	printf("throughput: %.0f requests/s\n", elapsed > 0 ? num / elapsed : 0);
+
+	free(tids);
+	free(args);
+	return 0;
+}
+
 int main(int argc, char **argv) {
 	int type;
 	int start;
 	int dest;
 	int i;
 	int num;
+	int threads;
+	int batch = 1;
 	srand(time(0));
 
-	if (argc != 2) {
-		printf("wrong number of args. producer.x num_of_requests\n");
+	if (argc < 2 || argc > 4) {
+		printf("wrong number of args. producer.x num_of_requests [num_of_threads [batch_size]]\n");
 		return -1;
 	}
 	sscanf(argv[1],"%d",&num);
+	if (argc >= 3) {
+		sscanf(argv[2], "%d", &threads);
+		if (argc == 4)
+			sscanf(argv[3], "%d", &batch);
+		if (threads < 1 || batch < 1 || batch > MAX_BATCH_REQUESTS) {
+			printf("num_of_threads must be at least 1 and batch_size between 1 and %d\n", MAX_BATCH_REQUESTS);
+			return -1;
+		}
+		return run_benchmark(num, threads, batch);
+	}
+
 	for(i=0; i < num;i+=1)
 	{
 		type = rnd(0,3);
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include "wrappers.h"
+
+// Feeds a recorded trace (see the module's record parameter) back to the
+// elevator. Requests that arrived at the same instant go in one
+// issue_requests call, at their original offsets from the first arrival,
+// or back to back with -f.
+
+struct trace {
+	struct elevator_trace_header hdr;
+	struct elevator_trace_record *recs;
+};
+
+void usage(void) {
+	printf("usage: replay [-f] [-x speed] trace\n");
+}
+
+int read_trace(const char *path, struct trace *t) {
+	FILE *f = fopen(path, "rb");
+	size_t n;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	if (fread(&t->hdr, sizeof(t->hdr), 1, f) != 1 || t->hdr.magic != ELEVATOR_TRACE_MAGIC ||
+	    t->hdr.version != ELEVATOR_TRACE_VERSION || t->hdr.record_size != sizeof(*t->recs)) {
+		printf("%s: not an elevator trace\n", path);
+		fclose(f);
+		return -1;
+	}
+	t->recs = calloc(t->hdr.nr_records ? t->hdr.nr_records : 1, sizeof(*t->recs));
+	if (!t->recs) {
+		fclose(f);
+		return -1;
+	}
+	n = fread(t->recs, sizeof(*t->recs), t->hdr.nr_records, f);
+	fclose(f);
+	if (n < t->hdr.nr_records)
+		printf("%s: truncated after %zu of %u requests\n", path, n, t->hdr.nr_records);
+	t->hdr.nr_records = n;
+	return 0;
+}
+
+__u64 timespec_ns(struct timespec *ts) {
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+struct timespec ns_timespec(__u64 ns) {
+	struct timespec ts = { ns / 1000000000ULL, ns % 1000000000ULL };
+	return ts;
+}
+
+int main(int argc, char **argv) {
+	struct pet_request reqs[MAX_BATCH_REQUESTS];
+	struct timespec now;
+	struct trace t;
+	double speed = 1;
+	int fast = 0;
+	long queued = 0, rejected = 0, failed = 0;
+	__u64 start_ns, first_ns, late_max_ns = 0;
+	__u32 i, j;
+	int c;
+
+	while ((c = getopt(argc, argv, "fx:h")) != -1) {
+		switch (c) {
+		case 'f': fast = 1; break;
+		case 'x': speed = atof(optarg); break;
+		default:
+			usage();
+			return c == 'h' ? 0 : -1;
+		}
+	}
+	if (optind != argc - 1 || speed <= 0) {
+		usage();
+		return -1;
+	}
+	if (read_trace(argv[optind], &t))
+		return -1;
+
+	// Requests are due relative to the earliest one, which need not be
+	// the first in the file.
+	first_ns = t.hdr.nr_records ? t.recs[0].time_ns : 0;
+	for (i = 1; i < t.hdr.nr_records; i += 1)
+		if (t.recs[i].time_ns < first_ns)
+			first_ns = t.recs[i].time_ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	start_ns = timespec_ns(&now);
+	for (i = 0; i < t.hdr.nr_records; i = j) {
+		__u64 at = t.recs[i].time_ns;
+		int n = 0;
+
+		for (j = i; j < t.hdr.nr_records && t.recs[j].time_ns == at && n < MAX_BATCH_REQUESTS; j += 1, n += 1) {
+			reqs[n].start_floor = t.recs[j].start_floor;
+			reqs[n].destination_floor = t.recs[j].destination_floor;
+			reqs[n].type = t.recs[j].type;
+			reqs[n].status = 0;
+		}
+
+		if (!fast) {
+			__u64 due = start_ns + (__u64)((at - first_ns) / speed);
+			struct timespec ts = ns_timespec(due);
+
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+				;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (timespec_ns(&now) - due > late_max_ns)
+				late_max_ns = timespec_ns(&now) - due;
+		}
+
+		c = issue_requests(reqs, n);
+		if (c < 0) {
+			failed += n;
+			continue;
+		}
+		queued += c;
+		rejected += n - c;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	printf("requests: %u\n", t.hdr.nr_records);
+	printf("dropped_while_recording: %llu\n", (unsigned long long)t.hdr.dropped);
+	printf("queued: %ld\n", queued);
+	printf("rejected: %ld\n", rejected);
+	printf("failed: %ld\n", failed);
+	printf("elapsed: %.3f s\n", (timespec_ns(&now) - start_ns) / 1e9);
+	if (!fast)
+		printf("late_max_ms: %.3f\n", late_max_ns / 1e6);
+	free(t.recs);
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,43 @@
+#ifndef __RING_H
+#define __RING_H
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../elevator_uapi.h"
+
+struct elevator_ring_header *map_ring(int fd, size_t *size) {
+	struct elevator_ring_header *hdr;
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	hdr = mmap(NULL, page, PROT_READ, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED)
+		return NULL;
+	if (hdr->magic != ELEVATOR_RING_MAGIC || hdr->version != ELEVATOR_RING_VERSION ||
+	    hdr->event_size != sizeof(struct elevator_event)) {
+		printf("unexpected event ring layout\n");
+		munmap(hdr, page);
+		return NULL;
+	}
+	*size = hdr->data_offset + (size_t)hdr->nr_events * hdr->event_size;
+	munmap(hdr, page);
+
+	hdr = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+	return hdr == MAP_FAILED ? NULL : hdr;
+}
+
+// Copy the event at pos. Returns 1 on success, 0 if it is not written yet
+// and -1 if it was overwritten before we got to it.
+int read_event(struct elevator_ring_header *hdr, __u64 pos, struct elevator_event *out) {
+	struct elevator_event *slot = elevator_ring_slot(hdr, pos);
+	__u64 seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+	if (seq != pos)
+		return (seq > pos || __atomic_load_n(&hdr->head, __ATOMIC_RELAXED) >= pos + hdr->nr_events) ? -1 : 0;
+	memcpy(out, slot, sizeof(*out));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == pos ? 1 : -1;
+}
+
+#endif
@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "wrappers.h"
+#include "params.h"
+
+// Submits pets through /dev/elevator_requests and waits for each one to
+// be delivered with epoll, instead of polling /proc/elevator. The pets are
+// spread over several fds to show that one epoll set covers them all.
+
+struct track_options {
+	int pets;
+	int fds;
+	int batch;
+	int quiet;
+	int high_pct; // percent of pets sent as high priority
+	int floors;
+	int types;
+};
+
+void usage(void) {
+	printf("usage: track [-n pets] [-c fds] [-b batch] [-p high_pct] [-q]\n");
+}
+
+void random_submit(struct track_options *opt, unsigned int *seed, __u64 id, struct elevator_submit *sub) {
+	memset(sub, 0, sizeof(*sub));
+	sub->user_data = id;
+	sub->priority = rand_r(seed) % 100 < opt->high_pct ? ELEVATOR_PRIO_HIGH : ELEVATOR_PRIO_NORMAL;
+	sub->type = rand_r(seed) % opt->types;
+	sub->start_floor = rand_r(seed) % opt->floors + 1;
+	do {
+		sub->destination_floor = rand_r(seed) % opt->floors + 1;
+	} while (sub->destination_floor == sub->start_floor);
+}
+
+// Submit opt->pets pets round robin over the fds, batch at a time.
+// prio[i] is set to the class of pet i.
+int submit_all(struct track_options *opt, int *fds, char *prio) {
+	struct elevator_submit *subs = calloc(opt->batch, sizeof(*subs));
+	unsigned int seed = time(0);
+	int done = 0, k = 0;
+	int i;
+
+	if (!subs)
+		return -1;
+	while (done < opt->pets) {
+		int n = opt->pets - done < opt->batch ? opt->pets - done : opt->batch;
+
+		for (i = 0; i < n; i += 1) {
+			random_submit(opt, &seed, done + i, &subs[i]);
+			prio[done + i] = subs[i].priority;
+		}
+		if (write(fds[k], subs, n * sizeof(*subs)) < 0) {
+			perror("write");
+			free(subs);
+			return -1;
+		}
+		done += n;
+		k = (k + 1) % opt->fds;
+	}
+	free(subs);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	struct track_options opt = { .pets = 100, .fds = 1, .batch = 16 };
+	struct epoll_event events[64];
+	struct elevator_completion c[64];
+	long delivered[ELEVATOR_NR_PRIO] = { 0 };
+	double wait_total[ELEVATOR_NR_PRIO] = { 0 }, ride_total[ELEVATOR_NR_PRIO] = { 0 };
+	long cancelled = 0, returned = 0;
+	double start;
+	char *prio;
+	int *fds;
+	int ep;
+	int i;
+
+	while ((i = getopt(argc, argv, "n:c:b:p:qh")) != -1) {
+		switch (i) {
+		case 'n': opt.pets = atoi(optarg); break;
+		case 'c': opt.fds = atoi(optarg); break;
+		case 'b': opt.batch = atoi(optarg); break;
+		case 'p': opt.high_pct = atoi(optarg); break;
+		case 'q': opt.quiet = 1; break;
+		default:
+			usage();
+			return i == 'h' ? 0 : -1;
+		}
+	}
+	if (optind != argc || opt.pets < 1 || opt.fds < 1 || opt.batch < 1 || opt.batch > MAX_BATCH_REQUESTS) {
+		usage();
+		return -1;
+	}
+	opt.floors = param_int("floors", 5);
+	opt.types = param_types(4);
+
+	fds = calloc(opt.fds, sizeof(*fds));
+	prio = calloc(opt.pets, 1);
+	ep = epoll_create1(0);
+	if (!fds || !prio || ep < 0) {
+		perror("epoll_create1");
+		return -1;
+	}
+	for (i = 0; i < opt.fds; i += 1) {
+		struct epoll_event ev = { .events = EPOLLIN };
+
+		fds[i] = open(ELEVATOR_REQUESTS_DEV, O_RDWR | O_NONBLOCK);
+		if (fds[i] < 0) {
+			perror(ELEVATOR_REQUESTS_DEV);
+			return -1;
+		}
+		ev.data.fd = fds[i];
+		epoll_ctl(ep, EPOLL_CTL_ADD, fds[i], &ev);
+	}
+
+	start = now_sec();
+	if (submit_all(&opt, fds, prio))
+		return -1;
+
+	while (returned < opt.pets) {
+		int nev = epoll_wait(ep, events, 64, -1);
+
+		if (nev < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+		for (i = 0; i < nev; i += 1) {
+			ssize_t len;
+			int j;
+
+			while ((len = read(events[i].data.fd, c, sizeof(c))) > 0) {
+				for (j = 0; j < len / (ssize_t)sizeof(c[0]); j += 1) {
+					int k = prio[c[j].user_data];
+
+					returned += 1;
+					if (c[j].status) {
+						cancelled += 1;
+						continue;
+					}
+					delivered[k] += 1;
+					wait_total[k] += c[j].wait_ns / 1e9;
+					ride_total[k] += c[j].ride_ns / 1e9;
+					if (!opt.quiet)
+						printf("request %llu (pet %llu%s): wait %.3f s, ride %.3f s\n",
+						       (unsigned long long)c[j].user_data, (unsigned long long)c[j].pet_id,
+						       k == ELEVATOR_PRIO_HIGH ? ", high" : "", c[j].wait_ns / 1e9, c[j].ride_ns / 1e9);
+				}
+			}
+		}
+	}
+
+	printf("pets: %d\n", opt.pets);
+	printf("fds: %d\n", opt.fds);
+	printf("delivered: %ld\n", delivered[ELEVATOR_PRIO_NORMAL] + delivered[ELEVATOR_PRIO_HIGH]);
+	printf("cancelled: %ld\n", cancelled);
+	for (i = 0; i < ELEVATOR_NR_PRIO; i += 1) {
+		const char *name = i == ELEVATOR_PRIO_HIGH ? "high" : "normal";
+		long n = delivered[i];
+
+		printf("%s_delivered: %ld\n", name, n);
+		printf("%s_wait_avg: %.3f s\n", name, n ? wait_total[i] / n : 0);
+		printf("%s_ride_avg: %.3f s\n", name, n ? ride_total[i] / n : 0);
+	}
+	printf("elapsed: %.3f s\n", now_sec() - start);
+	return 0;
+}
@@ -4,10 +4,12 @@
 #define _GNU_SOURCE
 #include <unistd.h>
 #include <sys/syscall.h>
+#include "../elevator_uapi.h"
 
 #define __NR_START_ELEVATOR 548
 #define __NR_ISSUE_REQUEST 549
 #define __NR_STOP_ELEVATOR 550
+#define __NR_ISSUE_REQUESTS 551
 
 int start_elevator() {
 	return syscall(__NR_START_ELEVATOR);
@@ -17,6 +19,11 @@ int issue_request(int start, int dest, int type) {
 	return syscall(__NR_ISSUE_REQUEST, start, dest, type);
 }
 
+// Returns the number of requests queued, or -1 with errno set.
+int issue_requests(struct pet_request *requests, int count) {
+	return syscall(__NR_ISSUE_REQUESTS, requests, count);
+}
+
 int stop_elevator() {
 	return syscall(__NR_STOP_ELEVATOR);
 }
@@ -0,0 +1,2399 @@
+#ifdef __KERNEL__
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/delay.h>
+#include <linux/version.h>
+#include <linux/limits.h>
+#include <linux/math64.h>
+#include <linux/spinlock.h>
+#include <linux/bitmap.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/sort.h>
+#include <linux/ctype.h>
+#include <linux/overflow.h>
+#include <linux/uaccess.h>
+#include <linux/jump_label.h>
+#include <linux/log2.h>
+
+// hrtimer_setup replaced hrtimer_init and a separate .function store.
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static inline void hrtimer_setup(struct hrtimer* timer, enum hrtimer_restart (*function)(struct hrtimer*),
+                                 clockid_t clock_id, enum hrtimer_mode mode) {
+    hrtimer_init(timer, clock_id, mode);
+    timer->function = function;
+}
+#endif
+#endif
+
+#include "elevator_core.h"
+
+#define CREATE_TRACE_POINTS
+#include "elevator_trace.h"
+
+#define PET_CACHE_NAME "elevator_pet"
+#define PET_FREE_BATCH 16
+#define EVENT_RING_PAGES 64 // event pages behind the ring header page
+#define DWELL_MS 1000 // doors open at a stop
+#define TRAVEL_MS 2000 // one floor up or down
+#define BOARD_LOOKAHEAD 64 // pets passed over per boarding scan
+#define PARK_DAY_SECS 86400
+#define PARK_MARGIN 8 // an idle car moves only to save over 1/8 of the expected travel
+
+// Keep the cache out of slab merging so it shows up by name in /proc/slabinfo.
+#ifdef SLAB_NO_MERGE
+#define PET_CACHE_FLAGS (SLAB_HWCACHE_ALIGN | SLAB_NO_MERGE)
+#else
+#define PET_CACHE_FLAGS SLAB_HWCACHE_ALIGN
+#endif
+
+static struct kmem_cache* pet_cache;
+struct elevator_ring_header* event_ring;
+size_t event_ring_size;
+static atomic64_t event_seq = ATOMIC64_INIT(0);
+static atomic64_t next_pet_id = ATOMIC64_INIT(0);
+
+struct building bld = {
+    .nr_floors = 5,
+    .capacity = 5,
+    .max_weight = 50,
+    .min_weight = 3,
+    .nr_types = 4,
+    .weights = { 3, 14, 10, 16 },
+    .letters = { 'C', 'P', 'H', 'D' },
+};
+
+// Index into scheds[]; set through elevator_set_policy.
+static int sched_policy = POLICY_LOOK;
+
+static int shutdown_elevator(void);
+static void cleanup_elevator_list(struct elevator* ele);
+static void cleanup_floor_list(struct floor* flo);
+static void free_pet_list(struct list_head* pets, int status);
+static void complete_pet(struct pet* p, int status);
+static void car_work_fn(struct work_struct* work);
+static enum hrtimer_restart car_timer_fn(struct hrtimer* timer);
+static int add_pet_to_floor(int type, int start_floor, int dest_floor);
+static void init_pet(struct pet* new_pet, int type, int start_floor, int dest_floor, ktime_t now);
+static void enqueue_pets(struct floor* flo, struct list_head* pets, int count);
+static void wake_elevator(struct elevator* ele);
+static void add_pet_to_elevator(struct elevator* pet_elevator, struct floor* flo, int dir);
+static struct elevator* assign_floor(struct floor* flo);
+static void release_floor(struct floor* flo);
+static bool claim_waiting_floors(struct elevator* ele);
+static bool dispense_pets_from_elevator(struct elevator* ele);
+static void update_work_floors(struct elevator* ele);
+static void stop_at_floor(struct elevator* ele, int dir);
+static int nearest_pick_next_floor(struct elevator* ele);
+static void publish_car_snapshot(struct elevator* ele);
+static void publish_floor_snapshot(struct floor* flo);
+
+
+struct elevator* cars = NULL;
+int nr_cars;
+struct floor* floors;
+// Bit (floor - 1) is set while that floor has pets waiting. Only changed
+// with the floor's lock held, so it always agrees with pets_waiting.
+static unsigned long* waiting_floors;
+// Same for pets heading up and pets heading down.
+static unsigned long* waiting_up;
+static unsigned long* waiting_down;
+// And for high priority pets.
+static unsigned long* waiting_high;
+
+// Debug messages, off by default and a patched-out branch while off.
+static DEFINE_STATIC_KEY_FALSE(elevator_debug);
+#define elevator_dbg(fmt, ...)                                           \
+    do {                                                                 \
+        if (static_branch_unlikely(&elevator_debug))                     \
+            printk(KERN_DEBUG "elevator: " fmt, ##__VA_ARGS__);          \
+    } while (0)
+
+void elevator_set_debug(bool on) {
+    if (on)
+        static_branch_enable(&elevator_debug);
+    else
+        static_branch_disable(&elevator_debug);
+}
+
+// Serializes elevator_start and elevator_stop.
+static DEFINE_MUTEX(control_lock);
+
+// Set by elevator_stop; every car delivers its riders and stops.
+static bool elevator_stopping;
+
+// The cars run as work items on car_wq, so a few workers serve them all.
+// Each step of a car either ends in a delay, after which the car's
+// hrtimer (or its turn on the virtual clock) queues the next step, or
+// puts the car to sleep until wake_elevator hands it work.
+static struct workqueue_struct* car_wq;
+static atomic_t cars_running; // cars that have not finished stopping
+static DECLARE_WAIT_QUEUE_HEAD(cars_done);
+// Redoes the parking plan on car_wq at each hour of the simulated day,
+// queued by park_timer or by its turn on the virtual clock.
+static struct work_struct park_work;
+static struct hrtimer park_timer;
+
+DEFINE_SRCU(elevator_srcu);
+
+// Simulated time. Every timestamp the module keeps or reports comes from
+// elevator_now(), so waits and rides are in simulated seconds whatever
+// time_scale the elevator was started with.
+static int sim_scale = 1; // time_scale of the running elevator
+static ktime_t sim_epoch; // simulated time at the last start
+static ktime_t real_epoch; // ktime_get() at the last start
+static u64 park_tod; // wall clock seconds at the last start
+
+// With sim_scale 0 the clock only moves once every car is either idle or
+// waiting out a delay, and then jumps straight to the earliest wake-up.
+// Cars due at the same instant take turns, lowest number first, so a run
+// on the virtual clock never depends on how the workers get scheduled.
+static DEFINE_SPINLOCK(sim_lock);
+static DECLARE_WAIT_QUEUE_HEAD(sim_wait); // for elevator_clock_wait
+static ktime_t sim_clock;
+static int sim_running; // cars and callers holding the clock, under sim_lock
+// elevator_clock_wait's caller: 0 while it holds the clock, the time it
+// waits for, or KTIME_MAX. Under sim_lock.
+static ktime_t sim_ext_wake = KTIME_MAX;
+// park_work: the next hour boundary, 0 while it runs, or KTIME_MAX with
+// park off. Under sim_lock.
+static ktime_t sim_park_wake = KTIME_MAX;
+
+ktime_t elevator_now(void) {
+    int scale = READ_ONCE(sim_scale);
+
+    if (!scale) return READ_ONCE(sim_clock);
+    return ktime_add(sim_epoch, ktime_sub(ktime_get(), real_epoch) * scale);
+}
+
+// Move the virtual clock to the next wake-up and hand it to whoever is
+// due then: a waiting elevator_clock_wait caller first, then the lowest
+// numbered car, whose next step is queued. An hour boundary passed on the
+// way there goes to park_work before either. Called with sim_lock held
+// once nothing is running.
+static void sim_advance(void) {
+    struct elevator* all = READ_ONCE(cars);
+    ktime_t next = sim_ext_wake;
+    int first = -1;
+    int i;
+
+    for (i = 0; all && i < nr_cars; ++i) {
+        if (all[i].sim_wake < next) {
+            next = all[i].sim_wake;
+            first = i;
+        }
+    }
+    // Every car is idle; the clock waits for the next request.
+    if (next == KTIME_MAX) return;
+
+    if (sim_park_wake <= next) {
+        WRITE_ONCE(sim_clock, sim_park_wake);
+        sim_running++;
+        WRITE_ONCE(sim_park_wake, 0);
+        queue_work(car_wq, &park_work);
+        return;
+    }
+    WRITE_ONCE(sim_clock, next);
+    sim_running++;
+    if (first < 0) {
+        WRITE_ONCE(sim_ext_wake, 0);
+        wake_up_all(&sim_wait);
+    } else {
+        WRITE_ONCE(all[first].sim_wake, 0);
+        queue_work(car_wq, &all[first].work);
+    }
+}
+
+// Stop counting ele as running, until the virtual clock has advanced by
+// ms, or until it is handed work for ms 0. A car that goes idle before its
+// turn came simply gives the turn up.
+static void sim_block(struct elevator* ele, unsigned int ms) {
+    spin_lock(&sim_lock);
+    if (!ele->sim_wake) {
+        WRITE_ONCE(ele->sim_wake, ms ? ktime_add_ms(sim_clock, ms) : KTIME_MAX);
+        if (--sim_running == 0)
+            sim_advance();
+    } else if (!ms) {
+        WRITE_ONCE(ele->sim_wake, KTIME_MAX);
+    }
+    spin_unlock(&sim_lock);
+}
+
+// An idle car that has been handed work, or told to stop, is due at the
+// current instant.
+static void sim_unblock(struct elevator* ele) {
+    if (READ_ONCE(sim_scale)) return;
+    spin_lock(&sim_lock);
+    if (ele->sim_wake == KTIME_MAX) {
+        WRITE_ONCE(ele->sim_wake, sim_clock);
+        if (!sim_running)
+            sim_advance();
+    }
+    spin_unlock(&sim_lock);
+}
+
+static void sim_idle(struct elevator* ele) {
+    if (!READ_ONCE(sim_scale))
+        sim_block(ele, 0);
+}
+
+// Wait for simulated time t, then hold the clock until the next
+// elevator_clock_wait or elevator_clock_release, so whatever the caller
+// queues in between arrives at that one instant. On the virtual clock the
+// caller takes its turn like a car, ahead of the cars due at t, and a
+// caller already holding the clock hands it on without letting it pass t.
+// Only one caller may use this at a time.
+void elevator_clock_wait(ktime_t t) {
+    int scale = READ_ONCE(sim_scale);
+    ktime_t now = elevator_now();
+
+    if (scale) {
+        if (t > now)
+            fsleep(div_u64(ktime_to_us(ktime_sub(t, now)), scale));
+        return;
+    }
+    spin_lock(&sim_lock);
+    if (!sim_ext_wake)
+        sim_running--;
+    WRITE_ONCE(sim_ext_wake, max(t, sim_clock));
+    if (!sim_running)
+        sim_advance();
+    spin_unlock(&sim_lock);
+    wait_event_interruptible(sim_wait, !READ_ONCE(sim_ext_wake));
+}
+
+void elevator_clock_hold(void) {
+    elevator_clock_wait(elevator_now());
+}
+
+void elevator_clock_release(void) {
+    if (READ_ONCE(sim_scale)) return;
+    spin_lock(&sim_lock);
+    WRITE_ONCE(sim_ext_wake, KTIME_MAX);
+    if (--sim_running == 0)
+        sim_advance();
+    spin_unlock(&sim_lock);
+}
+
+static enum hrtimer_restart car_timer_fn(struct hrtimer* timer) {
+    struct elevator* ele = container_of(timer, struct elevator, timer);
+
+    queue_work(car_wq, &ele->work);
+    return HRTIMER_NORESTART;
+}
+
+// Travel and dwell time, scaled down or skipped: the car's next step runs
+// once it is over. Never called with the car's lock held.
+static void car_delay(struct elevator* ele, unsigned int ms) {
+    int scale = READ_ONCE(sim_scale);
+
+    if (scale) {
+        hrtimer_start(&ele->timer, ns_to_ktime(div_u64((u64)ms * NSEC_PER_MSEC, scale)), HRTIMER_MODE_REL);
+        return;
+    }
+    sim_block(ele, ms);
+}
+
+// Leave the car asleep until wake_elevator hands it work, unless it was
+// handed some while it decided to sleep. Never called with its lock held.
+static void car_sleep(struct elevator* ele) {
+    if (!READ_ONCE(sim_scale)) {
+        // sim_lock orders this against wake_elevator's sim_unblock.
+        sim_block(ele, 0);
+        if (!bitmap_empty(ele->claimed, bld.nr_floors) || READ_ONCE(elevator_stopping))
+            sim_unblock(ele);
+        return;
+    }
+    // Either the car sees the claim or wake_elevator sees it asleep; the
+    // exchanges are full barriers.
+    atomic_xchg(&ele->asleep, 1);
+    if (!bitmap_empty(ele->claimed, bld.nr_floors) || READ_ONCE(elevator_stopping))
+        wake_elevator(ele);
+}
+
+// Append one event to the mmap-able ring. Slots are claimed with one atomic
+// increment, so producers and the cars never wait on each other.
+static void emit_event(u8 type, struct elevator* ele, struct pet* p, int floor, enum elevator_state state) {
+    struct elevator_event* ev;
+    u64 seq;
+
+    seq = atomic64_inc_return(&event_seq);
+    ev = elevator_ring_slot(event_ring, seq);
+    WRITE_ONCE(ev->seq, 0);
+    smp_wmb();
+    ev->time_ns = ktime_to_ns(elevator_now());
+    ev->pet_id = p ? p->id : 0;
+    ev->type = type;
+    ev->pet_type = p ? p->pet_type : 0;
+    ev->state = state;
+    ev->car = ele ? ele->id + 1 : 0;
+    ev->floor = floor;
+    ev->dest = p ? p->destination_floor : 0;
+    smp_store_release(&ev->seq, seq);
+    WRITE_ONCE(event_ring->head, seq);
+}
+
+static void emit_pet_event(u8 type, struct elevator* ele, struct pet* p, int floor) {
+    emit_event(type, ele, p, floor, 0);
+}
+
+// Dispatch latency: time from issue_request to the pet being picked up.
+static DEFINE_SPINLOCK(stats_lock);
+static u64 dispatch_samples;
+static u64 dispatch_total_ns;
+static u64 dispatch_max_ns;
+// Car utilization, per departure with pets on board.
+static u64 trips;
+static u64 trip_load_total;
+static u64 trip_pets_total;
+
+static struct class_stats class_stats[ELEVATOR_NR_PRIO];
+// How long each car step held the car's lock, in real time.
+static u64 lock_hold_samples;
+static u64 lock_hold_total_ns;
+static u64 lock_hold_max_ns;
+
+static void reset_dispatch_stats(void) {
+    spin_lock(&stats_lock);
+    memset(class_stats, 0, sizeof(class_stats));
+    dispatch_samples = 0;
+    dispatch_total_ns = 0;
+    dispatch_max_ns = 0;
+    trips = 0;
+    trip_load_total = 0;
+    trip_pets_total = 0;
+    lock_hold_samples = 0;
+    lock_hold_total_ns = 0;
+    lock_hold_max_ns = 0;
+    spin_unlock(&stats_lock);
+}
+
+// Admission control. total_admitted is the sum of every floor's admitted.
+static atomic_t total_admitted;
+static atomic_t total_admitted_max;
+static atomic64_t rejected_requests;
+
+// Add n to v unless that takes it past limit; 0 means no limit.
+static bool admit(atomic_t* v, int n, int limit) {
+    int old = atomic_read(v);
+
+    do {
+        if (limit && old + n > limit) return false;
+    } while (!atomic_try_cmpxchg(v, &old, old + n));
+    return true;
+}
+
+static void raise_max(atomic_t* max, int v) {
+    int old = atomic_read(max);
+
+    while (v > old && !atomic_try_cmpxchg(max, &old, v))
+        ;
+}
+
+// Reserve room for n pets at flo before allocating them, so a full floor
+// costs nothing. Called inside elevator_srcu.
+// Callers count what they refuse in rejected_requests.
+static int admit_pets(struct floor* flo, int n) {
+    if (!admit(&flo->admitted, n, bld.max_floor_waiting))
+        return -EAGAIN;
+    if (!admit(&total_admitted, n, bld.max_waiting)) {
+        atomic_sub(n, &flo->admitted);
+        return -EAGAIN;
+    }
+    return 0;
+}
+
+// Give back room taken by admit_pets, when pets board or never get queued.
+static void unadmit_pets(struct floor* flo, int n) {
+    atomic_sub(n, &flo->admitted);
+    atomic_sub(n, &total_admitted);
+}
+
+static struct sched_stats sched_stats[NR_POLICIES];
+static ktime_t sched_since; // start of the running policy's current period, 0 while stopped
+
+// Charge the time since sched_since to the current policy. Called with
+// stats_lock held.
+static void account_sched_time(ktime_t now) {
+    if (!sched_since) return;
+    sched_stats[sched_policy].active_ns += ktime_to_ns(ktime_sub(now, sched_since));
+    sched_since = now;
+}
+
+// Histogram bucket of a time: under 1 ms, then one per power of two ms.
+static int latency_bucket(u64 ns, int nr) {
+    u64 ms = div_u64(ns, NSEC_PER_MSEC);
+
+    return ms ? min(ilog2(ms) + 1, nr - 1) : 0;
+}
+
+// Called by the cars while the floors are up.
+static void record_latency(int floor, enum latency_kind kind, u64 ns) {
+    this_cpu_inc(floors[floor - 1].latency->hist[kind][latency_bucket(ns, LATENCY_BUCKETS)]);
+}
+
+static void record_boarding(struct pet* p) {
+    struct class_stats* cs;
+    int bucket;
+    u64 ns;
+
+    p->board_time = elevator_now();
+    ns = ktime_to_ns(ktime_sub(p->board_time, p->enqueue_time));
+    record_latency(p->starting_floor, LAT_WAIT_FROM, ns);
+    record_latency(p->destination_floor, LAT_WAIT_TO, ns);
+
+    bucket = latency_bucket(ns, WAIT_HIST_BUCKETS);
+    cs = &class_stats[p->priority];
+
+    spin_lock(&stats_lock);
+    dispatch_samples++;
+    dispatch_total_ns += ns;
+    if (ns > dispatch_max_ns) dispatch_max_ns = ns;
+    cs->boarded++;
+    cs->wait_total_ns += ns;
+    if (ns > cs->wait_max_ns) cs->wait_max_ns = ns;
+    cs->hist[bucket]++;
+    sched_stats[sched_policy].boarded++;
+    sched_stats[sched_policy].wait_total_ns += ns;
+    spin_unlock(&stats_lock);
+}
+
+static void record_trip(struct elevator* ele) {
+    spin_lock(&stats_lock);
+    trips++;
+    trip_load_total += ele->current_weight;
+    trip_pets_total += ele->num_of_pets;
+    spin_unlock(&stats_lock);
+}
+
+static void record_deliveries(int count, u64 ride_ns) {
+    spin_lock(&stats_lock);
+    sched_stats[sched_policy].serviced += count;
+    sched_stats[sched_policy].ride_total_ns += ride_ns;
+    spin_unlock(&stats_lock);
+}
+
+// Idle parking. Each floor counts its arrivals per hour of the day. At
+// start, and then at every hour boundary from park_work, a plan is made of
+// where idle cars are best placed, going by that hour and the ones either
+// side of it: the first car where it leaves the least distance to the next
+// pickup, each further one where it takes the most off what the cars
+// before it leave. An idle car picks from the places the other idle cars
+// have not taken.
+static struct park_cell (*park_demand)[PARK_BUCKETS]; // one row per floor
+static int park_demand_floors;
+
+// Day and hour of the day on the simulated clock, which follows the wall
+// clock from the last start.
+static u32 park_day(int* hour) {
+    u64 secs = park_tod + div_u64(ktime_to_ns(ktime_sub(elevator_now(), sim_epoch)), NSEC_PER_SEC);
+    u32 rem;
+    u32 day = div_u64_rem(secs, PARK_DAY_SECS, &rem);
+
+    *hour = rem / (PARK_DAY_SECS / PARK_BUCKETS);
+    return day;
+}
+
+// Simulated time of the next hour boundary.
+static ktime_t park_next_hour(void) {
+    u64 hour_ns = (u64)(PARK_DAY_SECS / PARK_BUCKETS) * NSEC_PER_SEC;
+    u64 tod_ns = park_tod * NSEC_PER_SEC;
+    u64 t = tod_ns + ktime_to_ns(ktime_sub(elevator_now(), sim_epoch));
+
+    return ktime_add_ns(sim_epoch, (div64_u64(t, hour_ns) + 1) * hour_ns - tod_ns);
+}
+
+static u32 park_heat(const struct park_cell* c, u32 day) {
+    u32 heat = READ_ONCE(c->heat);
+    u32 last = READ_ONCE(c->day);
+    // The wall clock can go back between runs; don't age the heat then.
+    u32 days = day > last ? day - last : 0;
+
+    for (; heat && days; --days)
+        heat = heat * 3 / 4;
+    return heat;
+}
+
+// Called with flo->lock held.
+static void record_demand(struct floor* flo, int count) {
+    struct park_cell* c;
+    int hour;
+    u32 day = park_day(&hour);
+    u32 heat;
+
+    c = &park_demand[flo->floor_num - 1][hour];
+    heat = park_heat(c, day);
+    WRITE_ONCE(c->heat, min_t(u32, heat + count * PARK_HEAT_ONE, U32_MAX / 4));
+    WRITE_ONCE(c->day, day);
+}
+
+// Expected floors to travel to the next pickup with a car waiting at floor.
+static u64 park_cost(const struct park_point* pts, int k, int floor) {
+    u64 cost = 0;
+    int i;
+
+    for (i = 0; i < k; ++i)
+        cost += (u64)pts[i].weight * min(abs(pts[i].floor - floor), pts[i].cover);
+    return cost;
+}
+
+// The plan for the current hour: the floors with demand, and the places
+// for the first, second, ... idle car. park_mutex serializes its writers,
+// which build it in park_scratch; the cars copy it out under seq.
+static DEFINE_MUTEX(park_mutex);
+static struct park_plan
+{
+    seqcount_mutex_t seq;
+    u32 gen; // bumped by every plan
+    int nr_points;
+    struct park_point* points; // nr_floors of them
+    int nr_slots;
+    int slots[MAX_CARS];
+} park_plan;
+static struct park_point* park_scratch; // nr_floors of them
+
+// Plan the hour that has just begun. Never called with a car's lock held.
+static void build_park_plan(void) {
+    struct park_point* pts = park_scratch;
+    int slots[MAX_CARS];
+    int hour, prev, next;
+    u32 day;
+    int i, k = 0, n = 0;
+
+    mutex_lock(&park_mutex);
+    day = park_day(&hour);
+    prev = (hour + PARK_BUCKETS - 1) % PARK_BUCKETS;
+    next = (hour + 1) % PARK_BUCKETS;
+    for (i = 0; i < bld.nr_floors; ++i) {
+        const struct park_cell* d = park_demand[i];
+        u32 w = 2 * park_heat(&d[hour], day) + park_heat(&d[prev], day) + park_heat(&d[next], day);
+
+        if (!w) continue;
+        pts[k].floor = i + 1;
+        pts[k].weight = w;
+        pts[k].cover = INT_MAX;
+        k++;
+    }
+
+    while (n < min(nr_cars, k)) {
+        int best = pts[0].floor;
+        u64 best_cost = park_cost(pts, k, best);
+
+        for (i = 1; i < k; ++i) {
+            u64 cost = park_cost(pts, k, pts[i].floor);
+
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = pts[i].floor;
+            }
+        }
+        slots[n++] = best;
+        // Every floor with demand has a car on it.
+        if (!best_cost) break;
+        for (i = 0; i < k; ++i)
+            pts[i].cover = min(pts[i].cover, abs(pts[i].floor - best));
+    }
+
+    write_seqcount_begin(&park_plan.seq);
+    for (i = 0; i < k; ++i) {
+        park_plan.points[i] = pts[i];
+        park_plan.points[i].cover = INT_MAX;
+    }
+    park_plan.nr_points = k;
+    memcpy(park_plan.slots, slots, n * sizeof(slots[0]));
+    park_plan.nr_slots = n;
+    WRITE_ONCE(park_plan.gen, park_plan.gen + 1);
+    write_seqcount_end(&park_plan.seq);
+    mutex_unlock(&park_mutex);
+}
+
+// Queue park_work at the next hour boundary, or on the virtual clock hand
+// the clock back with that as park_work's next turn.
+static void arm_park_work(void) {
+    ktime_t next = READ_ONCE(elevator_stopping) ? KTIME_MAX : park_next_hour();
+    int scale = READ_ONCE(sim_scale);
+
+    if (scale) {
+        if (next != KTIME_MAX)
+            hrtimer_start(&park_timer, ns_to_ktime(div_u64(ktime_to_ns(ktime_sub(next, elevator_now())), scale)),
+                          HRTIMER_MODE_REL);
+        return;
+    }
+    spin_lock(&sim_lock);
+    WRITE_ONCE(sim_park_wake, next);
+    if (--sim_running == 0)
+        sim_advance();
+    spin_unlock(&sim_lock);
+}
+
+static enum hrtimer_restart park_timer_fn(struct hrtimer* timer) {
+    queue_work(car_wq, &park_work);
+    return HRTIMER_NORESTART;
+}
+
+// A new hour: plan it and have every idle car look again. A car on its way
+// to its old place picks the new one at its next step.
+static void park_work_fn(struct work_struct* work) {
+    struct elevator* all = READ_ONCE(cars);
+    int i;
+
+    if (!READ_ONCE(elevator_stopping)) {
+        build_park_plan();
+        for (i = 0; i < nr_cars; ++i)
+            if (READ_ONCE(all[i].park_floor))
+                wake_elevator(&all[i]);
+    }
+    arm_park_work();
+}
+
+// The floor for the idle car to wait at: of the places in the plan that
+// the other idle cars leave free, the one that leaves the least distance
+// to the next pickup given where they wait. It stays put while nobody has
+// come by at this time of day, or when moving would save no more than
+// 1/PARK_MARGIN of the expected travel. Called with ele->lock held.
+static int pick_park_floor(struct elevator* ele) {
+    struct elevator* all = READ_ONCE(cars);
+    struct park_point* pts = ele->park;
+    int slots[MAX_CARS];
+    int cur = ele->current_floor;
+    int best = cur;
+    unsigned int seq;
+    u64 stay, cost, best_cost;
+    int i, j, k, n;
+
+    do {
+        seq = read_seqcount_begin(&park_plan.seq);
+        k = park_plan.nr_points;
+        n = park_plan.nr_slots;
+        memcpy(pts, park_plan.points, k * sizeof(*pts));
+        memcpy(slots, park_plan.slots, n * sizeof(slots[0]));
+        ele->park_gen = READ_ONCE(park_plan.gen);
+    } while (read_seqcount_retry(&park_plan.seq, seq));
+    if (!k) return cur;
+
+    for (j = 0; j < nr_cars; ++j) {
+        int at = READ_ONCE(all[j].park_floor);
+
+        if (j == ele->id || !at) continue;
+        for (i = 0; i < k; ++i)
+            pts[i].cover = min(pts[i].cover, abs(pts[i].floor - at));
+        for (i = 0; i < n; ++i)
+            if (slots[i] == at) slots[i] = 0;
+    }
+
+    stay = best_cost = park_cost(pts, k, cur);
+    for (i = 0; i < n; ++i) {
+        if (!slots[i]) continue;
+        cost = park_cost(pts, k, slots[i]);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = slots[i];
+        }
+    }
+    if (stay - best_cost <= div_u64(stay, PARK_MARGIN)) return cur;
+    return best;
+}
+
+// Where an idle car heads next: its parking floor, or 0 once it is there.
+// The floor is picked when the car runs out of work and kept until it has
+// some again or the hour's plan changes.
+static int park_target(struct elevator* ele) {
+    if (!bld.park) return 0;
+    if (!ele->park_floor || ele->park_gen != READ_ONCE(park_plan.gen))
+        WRITE_ONCE(ele->park_floor, pick_park_floor(ele));
+    return ele->park_floor == ele->current_floor ? 0 : ele->park_floor;
+}
+
+// Request recording for trace replay. The log is only replaced or freed
+// with both record_mutex and record_lock held; producers append under
+// record_lock alone and readers copy out under record_mutex.
+struct request_log
+{
+    u32 cap;
+    u32 len;
+    u64 dropped;
+    u64 last_ns; // time of the latest record
+    struct elevator_trace_record recs[];
+};
+static DEFINE_MUTEX(record_mutex);
+static DEFINE_SPINLOCK(record_lock);
+static struct request_log* record_log;
+static bool recording;
+
+// Log newly queued pets, in request order. Producers stamp their pets
+// before they get here, so one that lost the race for record_lock is
+// logged at the time of the record before it, keeping the log in order.
+static void record_pets(void** pets, int count) {
+    struct request_log* log;
+    int i;
+
+    if (!READ_ONCE(recording)) return;
+    spin_lock(&record_lock);
+    log = record_log;
+    for (i = 0; log && i < count; ++i) {
+        struct pet* p = pets[i];
+        struct elevator_trace_record* rec;
+
+        if (log->len == log->cap) {
+            log->dropped++;
+            continue;
+        }
+        rec = &log->recs[log->len++];
+        log->last_ns = max_t(u64, log->last_ns, ktime_to_ns(p->enqueue_time));
+        rec->time_ns = log->last_ns;
+        rec->start_floor = p->starting_floor;
+        rec->destination_floor = p->destination_floor;
+        rec->type = p->pet_type;
+    }
+    spin_unlock(&record_lock);
+}
+
+// Start a fresh log of up to cap requests, or stop recording for cap 0.
+// A stopped log stays readable until the next start.
+int elevator_record(unsigned int cap) {
+    struct request_log* log = NULL;
+    struct request_log* old = NULL;
+
+    if (cap > MAX_RECORDED_REQUESTS) return -EINVAL;
+    if (cap) {
+        log = kvzalloc(struct_size(log, recs, cap), GFP_KERNEL);
+        if (!log) return -ENOMEM;
+        log->cap = cap;
+    }
+
+    mutex_lock(&record_mutex);
+    spin_lock(&record_lock);
+    if (log) {
+        old = record_log;
+        record_log = log;
+    }
+    WRITE_ONCE(recording, cap != 0);
+    spin_unlock(&record_lock);
+    mutex_unlock(&record_mutex);
+    kvfree(old);
+    return 0;
+}
+
+// read(2) the log as a trace file: the header, then the records.
+ssize_t elevator_read_trace(char __user* buf, size_t count, loff_t* pos) {
+    struct elevator_trace_header hdr = {
+        .magic = ELEVATOR_TRACE_MAGIC,
+        .version = ELEVATOR_TRACE_VERSION,
+        .record_size = sizeof(struct elevator_trace_record),
+    };
+    size_t size, done = 0;
+    ssize_t ret = 0;
+
+    mutex_lock(&record_mutex);
+    if (record_log) {
+        spin_lock(&record_lock);
+        hdr.nr_records = record_log->len;
+        hdr.dropped = record_log->dropped;
+        spin_unlock(&record_lock);
+    }
+    size = sizeof(hdr) + (size_t)hdr.nr_records * hdr.record_size;
+    if (*pos < 0 || *pos >= size) goto out;
+    count = min(count, (size_t)(size - *pos));
+
+    if (*pos < sizeof(hdr)) {
+        done = min(count, (size_t)(sizeof(hdr) - *pos));
+        if (copy_to_user(buf, (char*)&hdr + *pos, done)) {
+            ret = -EFAULT;
+            goto out;
+        }
+    }
+    // Records below len are complete; appends only go past it.
+    if (done < count && copy_to_user(buf + done, (char*)record_log->recs + (*pos + done - sizeof(hdr)),
+                                     count - done)) {
+        ret = -EFAULT;
+        goto out;
+    }
+    *pos += count;
+    ret = count;
+out:
+    mutex_unlock(&record_mutex);
+    return ret;
+}
+
+static int init_car(struct elevator* ele, int id, int nr_floors) {
+    int i;
+
+    ele->dest_count = kcalloc(nr_floors, sizeof(*ele->dest_count), GFP_KERNEL);
+    ele->dest_pets = kmalloc_array(nr_floors, sizeof(*ele->dest_pets), GFP_KERNEL);
+    ele->dest_floors = bitmap_zalloc(nr_floors, GFP_KERNEL);
+    ele->claimed = bitmap_zalloc(nr_floors, GFP_KERNEL);
+    ele->work_floors = bitmap_zalloc(nr_floors, GFP_KERNEL);
+    ele->park = kcalloc(nr_floors, sizeof(*ele->park), GFP_KERNEL);
+    if (!ele->dest_count || !ele->dest_pets || !ele->dest_floors || !ele->claimed || !ele->work_floors ||
+        !ele->park)
+        return -ENOMEM;
+
+    ele->id = id;
+    ele->state = ELEVATOR_IDLE;
+    ele->current_floor = 1;
+    ele->direction = 1;
+    mutex_init(&ele->lock);
+    seqcount_mutex_init(&ele->seq, &ele->lock);
+    INIT_WORK(&ele->work, car_work_fn);
+    hrtimer_setup(&ele->timer, car_timer_fn, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    atomic_set(&ele->asleep, 0);
+    INIT_LIST_HEAD(&ele->pet_list);
+    ele->num_of_pets = 0;
+    ele->current_weight = 0;
+    ele->pets_serviced = 0;
+    ele->park_floor = 0;
+    ele->park_gen = 0;
+    for (i = 0; i < nr_floors; ++i)
+        INIT_LIST_HEAD(&ele->dest_pets[i]);
+
+    memset(&ele->snap, 0, sizeof(ele->snap));
+    mutex_lock(&ele->lock);
+    publish_car_snapshot(ele);
+    mutex_unlock(&ele->lock);
+    return 0;
+}
+
+// Free what elevator_start allocated. Nothing may be looking at it any more.
+static void free_elevator(struct elevator* old_cars, int n, struct floor* old_floors, int nr_floors) {
+    int i;
+
+    for (i = 0; old_cars && i < n; ++i) {
+        kfree(old_cars[i].dest_count);
+        kfree(old_cars[i].dest_pets);
+        bitmap_free(old_cars[i].dest_floors);
+        bitmap_free(old_cars[i].claimed);
+        bitmap_free(old_cars[i].work_floors);
+        kfree(old_cars[i].park);
+    }
+    kfree(old_cars);
+    for (i = 0; old_floors && i < nr_floors; ++i)
+        free_percpu(old_floors[i].latency);
+    kvfree(old_floors);
+    kfree(park_plan.points);
+    kfree(park_scratch);
+    bitmap_free(waiting_floors);
+    bitmap_free(waiting_up);
+    bitmap_free(waiting_down);
+    bitmap_free(waiting_high);
+    waiting_floors = NULL;
+    waiting_up = NULL;
+    waiting_down = NULL;
+    waiting_high = NULL;
+}
+
+// Parse a pet type table, "letter:weight" entries separated by commas.
+// spec is cut up in place.
+int elevator_parse_pet_types(struct building* b, char* spec) {
+    char* entry;
+
+    b->nr_types = 0;
+    b->min_weight = INT_MAX;
+    while ((entry = strsep(&spec, ",")) != NULL) {
+        int weight;
+
+        entry = strim(entry);
+        if (b->nr_types == MAX_PET_TYPES) return -EINVAL;
+        if (!isgraph(entry[0]) || entry[1] != ':') return -EINVAL;
+        if (kstrtoint(entry + 2, 10, &weight) || weight < 1) return -EINVAL;
+        b->letters[b->nr_types] = entry[0];
+        b->weights[b->nr_types] = weight;
+        b->min_weight = min(b->min_weight, weight);
+        b->nr_types++;
+    }
+    return 0;
+}
+
+int elevator_check_building(struct building* b) {
+    int i;
+
+    if (b->nr_floors < 2 || b->nr_floors > MAX_FLOORS) return -EINVAL;
+    if (b->capacity < 1 || b->capacity > MAX_CAPACITY) return -EINVAL;
+    // A pet heavier than an empty car can carry would wait forever.
+    for (i = 0; i < b->nr_types; ++i)
+        if (b->weights[i] > b->max_weight) return -EINVAL;
+    if (b->max_waiting < 0 || b->max_floor_waiting < 0) return -EINVAL;
+    if (b->board_age_ms < 0 || b->prio_age_ms < 0) return -EINVAL;
+    return 0;
+}
+
+// Start n cars in building b, scale times faster than real time or on the
+// virtual clock for scale 0. Returns 1 if the elevator is already running.
+int elevator_start(const struct building* b, int n, int scale) {
+    struct building new_bld = *b;
+    struct elevator* new_cars = NULL;
+    struct floor* new_floors = NULL;
+    ktime_t now;
+    int ret;
+    int i;
+
+    mutex_lock(&control_lock);
+    if (READ_ONCE(cars)) {
+        elevator_dbg("already active\n");
+        ret = 1;
+        goto out;
+    }
+    ret = -EINVAL;
+    if (n < 1 || n > MAX_CARS || scale < 0) goto out;
+    ret = elevator_check_building(&new_bld);
+    if (ret) goto out;
+
+    ret = -ENOMEM;
+    new_cars = kcalloc(n, sizeof(*new_cars), GFP_KERNEL);
+    new_floors = kvcalloc(new_bld.nr_floors, sizeof(*new_floors), GFP_KERNEL);
+    waiting_floors = bitmap_zalloc(new_bld.nr_floors, GFP_KERNEL);
+    waiting_up = bitmap_zalloc(new_bld.nr_floors, GFP_KERNEL);
+    waiting_down = bitmap_zalloc(new_bld.nr_floors, GFP_KERNEL);
+    waiting_high = bitmap_zalloc(new_bld.nr_floors, GFP_KERNEL);
+    park_plan.points = kcalloc(new_bld.nr_floors, sizeof(*park_plan.points), GFP_KERNEL);
+    park_scratch = kcalloc(new_bld.nr_floors, sizeof(*park_scratch), GFP_KERNEL);
+    if (!new_cars || !new_floors || !waiting_floors || !waiting_up || !waiting_down || !waiting_high ||
+        !park_plan.points || !park_scratch)
+        goto err_free;
+    // The heatmap outlives the run unless the floors it counts change.
+    if (park_demand_floors != new_bld.nr_floors) {
+        kvfree(park_demand);
+        park_demand = kvcalloc(new_bld.nr_floors, sizeof(*park_demand), GFP_KERNEL);
+        park_demand_floors = park_demand ? new_bld.nr_floors : 0;
+        if (!park_demand)
+            goto err_free;
+    }
+    for (i = 0; i < n; ++i)
+        if (init_car(&new_cars[i], i, new_bld.nr_floors))
+            goto err_free;
+
+    for (i = 0; i < new_bld.nr_floors; ++i) {
+        struct floor* flo = &new_floors[i];
+
+        flo->latency = alloc_percpu(struct floor_latency_pcpu);
+        if (!flo->latency)
+            goto err_free;
+
+        mutex_init(&flo->lock);
+        seqcount_mutex_init(&flo->seq, &flo->lock);
+        INIT_LIST_HEAD(&flo->pets_waiting);
+        atomic_set(&flo->num_waiting, 0);
+        atomic_set(&flo->admitted, 0);
+        flo->waiting_max = 0;
+        flo->num_up = 0;
+        flo->num_down = 0;
+        flo->num_high = 0;
+        flo->normal_since = KTIME_MAX;
+        flo->floor_num = i + 1;
+        flo->car = -1;
+        flo->elevator_at_floor = false;
+        flo->snap_count = 0;
+        flo->snap_len = 0;
+    }
+
+    // The simulated clock carries on from where the last run left it.
+    now = elevator_now();
+    sim_epoch = now;
+    real_epoch = ktime_get();
+    park_tod = ktime_get_real_seconds();
+    sim_clock = now;
+    sim_running = 0;
+    sim_ext_wake = KTIME_MAX;
+    for (i = 0; i < n; ++i)
+        new_cars[i].sim_wake = now;
+    WRITE_ONCE(sim_scale, scale);
+
+    reset_dispatch_stats();
+    atomic_set(&total_admitted, 0);
+    atomic_set(&total_admitted_max, 0);
+    atomic64_set(&rejected_requests, 0);
+    spin_lock(&stats_lock);
+    sched_since = elevator_now();
+    spin_unlock(&stats_lock);
+    WRITE_ONCE(elevator_stopping, false);
+    atomic_set(&cars_running, n);
+
+    // Producers can queue pets as soon as the floors are visible; the cars
+    // claim whatever is waiting on their first step.
+    bld = new_bld;
+    nr_cars = n;
+    // Place the cars by what earlier runs saw of this hour.
+    if (bld.park)
+        build_park_plan();
+    else {
+        park_plan.nr_points = 0;
+        park_plan.nr_slots = 0;
+    }
+    smp_store_release(&floors, new_floors);
+    smp_store_release(&cars, new_cars);
+    if (!scale) {
+        spin_lock(&sim_lock);
+        sim_park_wake = bld.park ? park_next_hour() : KTIME_MAX;
+        sim_advance();
+        spin_unlock(&sim_lock);
+    } else {
+        for (i = 0; i < n; ++i)
+            queue_work(car_wq, &new_cars[i].work);
+        if (bld.park)
+            hrtimer_start(&park_timer, ns_to_ktime(div_u64(ktime_to_ns(ktime_sub(park_next_hour(), now)), scale)),
+                          HRTIMER_MODE_REL);
+    }
+    ret = 0;
+    goto out;
+
+err_free:
+    printk(KERN_INFO "Couldn't allocate memory to run the elevator\n");
+    free_elevator(new_cars, n, new_floors, new_bld.nr_floors);
+out:
+    mutex_unlock(&control_lock);
+    return ret;
+}
+
+// Called with control_lock held.
+static int shutdown_elevator(void) {
+    struct elevator* old_cars = READ_ONCE(cars);
+    struct floor* old_floors;
+    bool ran;
+    int i;
+    if (!old_cars || READ_ONCE(elevator_stopping)) return 1;
+
+    // Every car delivers its riders, then finishes; sleeping cars are
+    // woken to do so.
+    WRITE_ONCE(elevator_stopping, true);
+    for (i = 0; i < nr_cars; ++i)
+        wake_elevator(&old_cars[i]);
+    wait_event(cars_done, !atomic_read(&cars_running));
+    for (i = 0; i < nr_cars; ++i) {
+        hrtimer_cancel(&old_cars[i].timer);
+        cancel_work_sync(&old_cars[i].work);
+    }
+    // park_work is let run rather than cancelled, since on the virtual
+    // clock it holds a turn; once it sees elevator_stopping it stops
+    // arming park_timer.
+    flush_work(&park_work);
+    hrtimer_cancel(&park_timer);
+    flush_work(&park_work);
+    elevator_dbg("stopped\n");
+
+    spin_lock(&stats_lock);
+    account_sched_time(elevator_now());
+    sched_since = 0;
+    spin_unlock(&stats_lock);
+
+    // Producers and /proc readers only hold elevator_srcu, so unpublish
+    // everything and wait them out before freeing.
+    old_floors = floors;
+    WRITE_ONCE(floors, NULL);
+    WRITE_ONCE(cars, NULL);
+    synchronize_srcu(&elevator_srcu);
+
+    // A producer that was still inside elevator_srcu may have woken a
+    // finished car: on the virtual clock that queues its work, which hands
+    // the turn straight back and may queue the next car's. Let every such
+    // step run out before the cars are freed.
+    do {
+        ran = false;
+        for (i = 0; i < nr_cars; ++i) {
+            hrtimer_cancel(&old_cars[i].timer);
+            if (flush_work(&old_cars[i].work))
+                ran = true;
+        }
+    } while (ran);
+
+    for (i = 0; i < nr_cars; ++i)
+        cleanup_elevator_list(&old_cars[i]);
+    for (i = 0; i < bld.nr_floors; ++i)
+        cleanup_floor_list(&old_floors[i]);
+    free_elevator(old_cars, nr_cars, old_floors, bld.nr_floors);
+    return 0;
+}
+
+int elevator_stop(void) {
+    int ret;
+
+    mutex_lock(&control_lock);
+    ret = shutdown_elevator();
+    mutex_unlock(&control_lock);
+    return ret;
+}
+
+// Checked against the running building, so callers hold elevator_srcu.
+static bool valid_request(int start_floor, int dest_floor, int type) {
+    if (start_floor < 1 || start_floor > bld.nr_floors) return false;
+    if (dest_floor < 1 || dest_floor > bld.nr_floors) return false;
+    if (type < 0 || type >= bld.nr_types) return false;
+    return true;
+}
+
+int elevator_issue_request(int start_floor, int dest_floor, int type) {
+    return add_pet_to_floor(type,start_floor,dest_floor);
+}
+
+// Batched pets are queued one floor at a time, in request order.
+static int cmp_start_floor(const void* a, const void* b) {
+    const struct pet* pa = *(const struct pet* const*)a;
+    const struct pet* pb = *(const struct pet* const*)b;
+
+    if (pa->starting_floor != pb->starting_floor)
+        return pa->starting_floor < pb->starting_floor ? -1 : 1;
+    return pa->id < pb->id ? -1 : pa->id > pb->id;
+}
+
+// Queue freshly initialized pets with one lock round per floor. Called
+// inside elevator_srcu.
+static void enqueue_batch(struct floor* all, void** new_pets, int count) {
+    int i, j;
+
+    record_pets(new_pets, count);
+    // Group the pets by floor without a list head per floor; ids break
+    // ties so each floor still gets its pets in request order.
+    sort(new_pets, count, sizeof(*new_pets), cmp_start_floor, NULL);
+    for (i = 0; i < count; i = j) {
+        int start_floor = ((struct pet*)new_pets[i])->starting_floor;
+        LIST_HEAD(batch);
+
+        for (j = i; j < count; ++j) {
+            struct pet* new_pet = new_pets[j];
+
+            if (new_pet->starting_floor != start_floor) break;
+            list_add_tail(&new_pet->list, &batch);
+        }
+        enqueue_pets(&all[start_floor - 1], &batch, j - i);
+    }
+}
+
+// Queue a whole array of requests with one lock round per floor, filling
+// in each entry's status. scratch has room for count pointers. Returns
+// the number queued.
+int elevator_queue_requests(struct pet_request* reqs, void** scratch, int count) {
+    void** new_pets = scratch;
+    struct floor* all;
+    int num_valid = 0;
+    int allocated;
+    int queued = 0;
+    int srcu_idx;
+    ktime_t now;
+    int i;
+
+    srcu_idx = srcu_read_lock(&elevator_srcu);
+    all = smp_load_acquire(&floors);
+    if (!all) {
+        srcu_read_unlock(&elevator_srcu, srcu_idx);
+        return -ENODEV;
+    }
+
+    for (i = 0; i < count; ++i) {
+        struct pet_request* req = &reqs[i];
+
+        if (!valid_request(req->start_floor, req->destination_floor, req->type)) {
+            req->status = 1;
+            continue;
+        }
+        req->status = admit_pets(&all[req->start_floor - 1], 1);
+        if (req->status == 0)
+            num_valid++;
+        else
+            atomic64_inc(&rejected_requests);
+    }
+    if (num_valid == 0) goto out;
+
+    // kmem_cache_alloc_bulk is all-or-nothing.
+    allocated = kmem_cache_alloc_bulk(pet_cache, GFP_KERNEL, num_valid, new_pets);
+    if (!allocated) {
+        for (i = 0; i < count; ++i) {
+            if (reqs[i].status != 0) continue;
+            unadmit_pets(&all[reqs[i].start_floor - 1], 1);
+            reqs[i].status = -ENOMEM;
+        }
+        goto out;
+    }
+
+    now = elevator_now();
+    for (i = 0; i < count; ++i) {
+        struct pet_request* req = &reqs[i];
+
+        if (req->status != 0) continue;
+        init_pet(new_pets[queued], req->type, req->start_floor, req->destination_floor, now);
+        queued++;
+    }
+    enqueue_batch(all, new_pets, queued);
+
+out:
+    srcu_read_unlock(&elevator_srcu, srcu_idx);
+    return queued;
+}
+
+struct elevator_session* elevator_session_create(void) {
+    struct elevator_session* s = kzalloc(sizeof(*s), GFP_KERNEL);
+
+    if (!s) return NULL;
+    spin_lock_init(&s->lock);
+    INIT_LIST_HEAD(&s->done);
+    init_waitqueue_head(&s->wait);
+    atomic_set(&s->refs, 1);
+    return s;
+}
+
+static void session_put(struct elevator_session* s) {
+    if (atomic_dec_and_test(&s->refs))
+        kfree(s);
+}
+
+// Hand p back to its session, or free it if the session has been closed.
+// Drops the reference p held.
+static void complete_pet(struct pet* p, int status) {
+    struct elevator_session* s = p->session;
+    bool queued = false;
+
+    p->status = status;
+    spin_lock(&s->lock);
+    if (!s->closed) {
+        list_add_tail(&p->list, &s->done);
+        queued = true;
+    }
+    spin_unlock(&s->lock);
+    if (queued)
+        wake_up_interruptible(&s->wait);
+    else
+        kmem_cache_free(pet_cache, p);
+    session_put(s);
+}
+
+// Queue every request or none: returns count, -EINVAL if any of them is
+// invalid, -EAGAIN if they do not all fit in the queues, or -ENODEV or
+// -ENOMEM. scratch has room for count pointers.
+int elevator_session_submit(struct elevator_session* s, const struct elevator_submit* subs,
+                            void** scratch, int count) {
+    struct floor* all;
+    int srcu_idx;
+    ktime_t now;
+    int ret;
+    int i;
+
+    srcu_idx = srcu_read_lock(&elevator_srcu);
+    all = smp_load_acquire(&floors);
+    ret = -ENODEV;
+    if (!all) goto out;
+    ret = -EINVAL;
+    for (i = 0; i < count; ++i) {
+        if (!valid_request(subs[i].start_floor, subs[i].destination_floor, subs[i].type)) goto out;
+        if (subs[i].priority < 0 || subs[i].priority >= ELEVATOR_NR_PRIO) goto out;
+    }
+    for (i = 0; i < count; ++i) {
+        ret = admit_pets(&all[subs[i].start_floor - 1], 1);
+        if (ret) {
+            atomic64_add(count, &rejected_requests);
+            goto err_unadmit;
+        }
+    }
+    ret = -ENOMEM;
+    if (!kmem_cache_alloc_bulk(pet_cache, GFP_KERNEL, count, scratch)) goto err_unadmit;
+
+    atomic_add(count, &s->refs);
+    now = elevator_now();
+    for (i = 0; i < count; ++i) {
+        struct pet* p = scratch[i];
+
+        init_pet(p, subs[i].type, subs[i].start_floor, subs[i].destination_floor, now);
+        p->session = s;
+        p->user_data = subs[i].user_data;
+        p->priority = subs[i].priority;
+    }
+    enqueue_batch(all, scratch, count);
+    ret = count;
+    goto out;
+
+err_unadmit:
+    while (i--)
+        unadmit_pets(&all[subs[i].start_floor - 1], 1);
+out:
+    srcu_read_unlock(&elevator_srcu, srcu_idx);
+    return ret;
+}
+
+bool elevator_session_ready(struct elevator_session* s) {
+    bool ready;
+
+    spin_lock(&s->lock);
+    ready = !list_empty(&s->done);
+    spin_unlock(&s->lock);
+    return ready;
+}
+
+// Take up to max completions, oldest first, without blocking.
+int elevator_session_read(struct elevator_session* s, struct elevator_completion* out, int max) {
+    struct pet* p;
+    LIST_HEAD(taken);
+    int n = 0;
+
+    spin_lock(&s->lock);
+    while (n < max && !list_empty(&s->done)) {
+        list_move_tail(s->done.next, &taken);
+        n++;
+    }
+    spin_unlock(&s->lock);
+
+    n = 0;
+    list_for_each_entry(p, &taken, list) {
+        struct elevator_completion* c = &out[n++];
+
+        memset(c, 0, sizeof(*c));
+        c->user_data = p->user_data;
+        c->pet_id = p->id;
+        c->status = p->status;
+        if (p->board_time)
+            c->wait_ns = ktime_to_ns(ktime_sub(p->board_time, p->enqueue_time));
+        if (!p->status)
+            c->ride_ns = ktime_to_ns(ktime_sub(p->done_time, p->board_time));
+        p->session = NULL;
+    }
+    free_pet_list(&taken, 0);
+    return n;
+}
+
+// The file is gone; pets still in the building are freed on delivery.
+void elevator_session_close(struct elevator_session* s) {
+    struct pet* p;
+    LIST_HEAD(taken);
+
+    spin_lock(&s->lock);
+    s->closed = true;
+    list_splice_init(&s->done, &taken);
+    spin_unlock(&s->lock);
+    list_for_each_entry(p, &taken, list)
+        p->session = NULL;
+    free_pet_list(&taken, 0);
+    session_put(s);
+}
+
+// Copy the car into its snapshot. Called with ele->lock held after every
+// change /proc/elevator can see.
+static void publish_car_snapshot(struct elevator* ele) {
+    struct pet* entry;
+    int n = 0;
+
+    write_seqcount_begin(&ele->seq);
+    ele->snap.state = ele->state;
+    ele->snap.current_floor = ele->current_floor;
+    ele->snap.load = ele->current_weight;
+    ele->snap.num_of_pets = ele->num_of_pets;
+    ele->snap.pets_serviced = ele->pets_serviced;
+    list_for_each_entry(entry, &ele->pet_list, car_list) {
+        if (n == ARRAY_SIZE(ele->snap.pets)) break;
+        ele->snap.pets[n].type = entry->pet_type;
+        ele->snap.pets[n].dest = entry->destination_floor;
+        n++;
+    }
+    write_seqcount_end(&ele->seq);
+}
+
+static void set_elevator_state(struct elevator* ele, enum elevator_state state) {
+    if (ele->state != state) {
+        emit_event(ELEVATOR_EV_STATE, ele, NULL, ele->current_floor, state);
+        trace_elevator_state(ele->id + 1, ele->current_floor, state);
+    }
+    ele->state = state;
+    publish_car_snapshot(ele);
+}
+
+static void move_elevator(struct elevator* ele, int delta) {
+    trace_elevator_move(ele->id + 1, ele->current_floor, ele->current_floor + delta);
+    ele->current_floor += delta;
+    ele->direction = delta;
+    emit_event(ELEVATOR_EV_ARRIVE, ele, NULL, ele->current_floor, ele->state);
+    set_elevator_state(ele, delta > 0 ? ELEVATOR_UP : ELEVATOR_DOWN);
+}
+
+#define CAR_SLEEP -1 // car_step: nothing to do
+#define CAR_DONE -2 // car_step: stopped, with nobody left on board
+
+static void car_lock(struct elevator* ele) {
+    mutex_lock(&ele->lock);
+    ele->locked_at = ktime_get();
+}
+
+static void car_unlock(struct elevator* ele) {
+    u64 ns = ktime_to_ns(ktime_sub(ktime_get(), ele->locked_at));
+
+    mutex_unlock(&ele->lock);
+    spin_lock(&stats_lock);
+    lock_hold_samples++;
+    lock_hold_total_ns += ns;
+    if (ns > lock_hold_max_ns) lock_hold_max_ns = ns;
+    spin_unlock(&stats_lock);
+}
+
+// Each car is a state machine, run one step at a time by car_step:
+//
+//   IDLE               asleep with nobody on board, parked if park is
+//                      set. Woken with work, the car dispatches; woken
+//                      to stop, it goes OFFLINE.
+//   LOADING, UP, DOWN  the doors have been open for DWELL_MS, or the car
+//                      has spent TRAVEL_MS reaching current_floor. It
+//                      dispatches, or delivers its riders while stopping.
+//   OFFLINE            stopped and empty; the car takes no more steps.
+//
+// Dispatching asks the current policy for a target afresh at each step,
+// so new requests count from the next floor on. It opens the doors here
+// (LOADING), moves one floor (UP, DOWN), or with nothing to do heads for
+// the parking floor or goes to sleep (IDLE).
+// Steps return the ms they take, 0 to step again at once, CAR_SLEEP or
+// CAR_DONE, and are called with ele->lock held.
+
+static int car_finish(struct elevator* ele) {
+    set_elevator_state(ele, ELEVATOR_OFFLINE);
+    return CAR_DONE;
+}
+
+// Nothing to pick up or deliver.
+static int car_go_idle(struct elevator* ele) {
+    int target;
+
+    if (claim_waiting_floors(ele)) return 0;
+    target = park_target(ele);
+    if (!target) {
+        set_elevator_state(ele, ELEVATOR_IDLE);
+        elevator_dbg("car %d: no requests right now\n", ele->id + 1);
+        return CAR_SLEEP;
+    }
+    elevator_dbg("car %d: parking at floor %d\n", ele->id + 1, target);
+    move_elevator(ele, target > ele->current_floor ? 1 : -1);
+    return TRAVEL_MS;
+}
+
+static int car_dispatch(struct elevator* ele) {
+    const struct elevator_sched* sched = scheds[READ_ONCE(sched_policy)];
+    int target, dir;
+
+    update_work_floors(ele);
+    target = sched->pick_next_floor(ele);
+    if (!target) return car_go_idle(ele);
+    if (ele->park_floor)
+        WRITE_ONCE(ele->park_floor, 0);
+
+    if (target == ele->current_floor) {
+        stop_at_floor(ele, 0);
+        return DWELL_MS;
+    }
+
+    dir = target > ele->current_floor ? 1 : -1;
+    if (sched->should_stop_here(ele, dir)) {
+        stop_at_floor(ele, dir);
+        return DWELL_MS;
+    }
+
+    elevator_dbg("car %d: moving %s a floor\n", ele->id + 1, dir > 0 ? "up" : "down");
+    move_elevator(ele, dir);
+    if (sched->on_arrival)
+        sched->on_arrival(ele);
+    return TRAVEL_MS;
+}
+
+// The elevator is stopping: drop off the riders, nearest first, and pick
+// nobody up.
+static int car_drain(struct elevator* ele) {
+    int target;
+
+    if (list_empty(&ele->pet_list)) return car_finish(ele);
+    if (dispense_pets_from_elevator(ele)) return DWELL_MS;
+    bitmap_copy(ele->work_floors, ele->dest_floors, bld.nr_floors);
+    target = nearest_pick_next_floor(ele);
+    move_elevator(ele, target > ele->current_floor ? 1 : -1);
+    return TRAVEL_MS;
+}
+
+static int car_step(struct elevator* ele) {
+    switch (ele->state) {
+    case ELEVATOR_IDLE:
+        if (READ_ONCE(elevator_stopping)) return car_finish(ele);
+        return car_dispatch(ele);
+    case ELEVATOR_LOADING:
+    case ELEVATOR_UP:
+    case ELEVATOR_DOWN:
+        if (READ_ONCE(elevator_stopping)) return car_drain(ele);
+        return car_dispatch(ele);
+    case ELEVATOR_OFFLINE:
+        break;
+    }
+    return CAR_DONE;
+}
+
+// Run the car's steps until one takes time, then wait it out without
+// holding any lock.
+static void car_work_fn(struct work_struct* work) {
+    struct elevator* ele = container_of(work, struct elevator, work);
+    int ms;
+
+    // A car that has finished may still be handed a turn on the virtual
+    // clock while stopping; it gives it straight back. Only the car's own
+    // steps change its state.
+    if (ele->state == ELEVATOR_OFFLINE) {
+        sim_idle(ele);
+        return;
+    }
+    do {
+        car_lock(ele);
+        ms = car_step(ele);
+        car_unlock(ele);
+    } while (!ms);
+
+    if (ms > 0) {
+        car_delay(ele, ms);
+    } else if (ms == CAR_SLEEP) {
+        car_sleep(ele);
+    } else {
+        sim_idle(ele);
+        if (atomic_dec_and_test(&cars_running))
+            wake_up_all(&cars_done);
+    }
+}
+
+// Return every pet on the list to pet_cache, PET_FREE_BATCH at a time.
+// Pets submitted through a session go back to it with status instead.
+static void free_pet_list(struct list_head* pets, int status) {
+    void* batch[PET_FREE_BATCH];
+    struct pet* entry, *next_entry;
+    size_t n = 0;
+
+    list_for_each_entry_safe(entry, next_entry, pets, list) {
+        list_del(&entry->list);
+        if (entry->session) {
+            complete_pet(entry, status);
+            continue;
+        }
+        batch[n++] = entry;
+        if (n == PET_FREE_BATCH) {
+            kmem_cache_free_bulk(pet_cache, n, batch);
+            n = 0;
+        }
+    }
+    if (n)
+        kmem_cache_free_bulk(pet_cache, n, batch);
+}
+
+static void cleanup_elevator_list(struct elevator* ele) {
+    unsigned long i;
+
+    for_each_set_bit(i, ele->dest_floors, bld.nr_floors)
+        free_pet_list(&ele->dest_pets[i], -ECANCELED);
+    bitmap_zero(ele->dest_floors, bld.nr_floors);
+    INIT_LIST_HEAD(&ele->pet_list);
+}
+
+static void cleanup_floor_list(struct floor* flo) {
+    mutex_lock(&flo->lock);
+    free_pet_list(&flo->pets_waiting, -ECANCELED);
+    atomic_set(&flo->num_waiting, 0);
+    flo->num_up = 0;
+    flo->num_down = 0;
+    flo->num_high = 0;
+    WRITE_ONCE(flo->normal_since, KTIME_MAX);
+    clear_bit(flo->floor_num - 1, waiting_floors);
+    clear_bit(flo->floor_num - 1, waiting_up);
+    clear_bit(flo->floor_num - 1, waiting_down);
+    clear_bit(flo->floor_num - 1, waiting_high);
+    publish_floor_snapshot(flo);
+    mutex_unlock(&flo->lock);
+}
+
+// Floor locks are where producers and cars meet, so waits for them are
+// traced. The clock is only read while the tracepoint is on.
+static void lock_floor(struct floor* flo) {
+    ktime_t start;
+
+    if (mutex_trylock(&flo->lock)) return;
+    if (!trace_elevator_lock_contended_enabled()) {
+        mutex_lock(&flo->lock);
+        return;
+    }
+    start = ktime_get();
+    mutex_lock(&flo->lock);
+    trace_elevator_lock_contended(flo->floor_num, ktime_to_ns(ktime_sub(ktime_get(), start)));
+}
+
+// Everyone getting off here is in one bucket, so only those pets are touched.
+static bool dispense_pets_from_elevator(struct elevator* ele) {
+    int idx = ele->current_floor - 1;
+    struct pet* entry;
+    ktime_t now = elevator_now();
+    u64 ride_ns = 0;
+    LIST_HEAD(arrived);
+
+    if (!test_bit(idx, ele->dest_floors))
+        return false;
+
+    ele->state = ELEVATOR_LOADING;
+    list_splice_init(&ele->dest_pets[idx], &arrived);
+    __clear_bit(idx, ele->dest_floors);
+    list_for_each_entry(entry, &arrived, list) {
+        u64 ns = ktime_to_ns(ktime_sub(now, entry->board_time));
+
+        elevator_dbg("pet type %d has reached its destination floor %d\n",
+                     entry->pet_type, entry->destination_floor);
+        list_del(&entry->car_list);
+        ele->current_weight -= entry->weight;
+        entry->done_time = now;
+        ride_ns += ns;
+        record_latency(entry->starting_floor, LAT_RIDE_FROM, ns);
+        record_latency(ele->current_floor, LAT_RIDE_TO, ns);
+        emit_pet_event(ELEVATOR_EV_DISPENSE, ele, entry, ele->current_floor);
+        trace_elevator_dispense(ele->id + 1, entry->id, entry->pet_type, ele->current_floor, ns);
+    }
+    record_deliveries(ele->dest_count[idx], ride_ns);
+    ele->num_of_pets -= ele->dest_count[idx];
+    ele->pets_serviced += ele->dest_count[idx];
+    ele->dest_count[idx] = 0;
+    publish_car_snapshot(ele);
+    free_pet_list(&arrived, 0);
+    return true;
+}
+
+static bool pet_fits(struct elevator* ele, int weight) {
+    return ele->num_of_pets < bld.capacity && ele->current_weight + weight <= bld.max_weight;
+}
+
+static int pet_heading(struct pet* p) {
+    return p->destination_floor > p->starting_floor ? 1 : -1;
+}
+
+// The next pet after pos in flo's queue heading dir (any pet for dir 0)
+// that could board right now, or NULL. Strict boarding stops at the first
+// pet that does not fit. With board_fill the lighter pets behind it go
+// first, until one that does not fit has waited board_age_ms: nobody
+// passes it after that, so it gets the next car with room. Called with
+// flo->lock held.
+static struct pet* next_boarder(struct elevator* ele, struct floor* flo, struct pet* pos, int dir,
+                                ktime_t now) {
+    ktime_t aged = ktime_sub(now, ms_to_ktime(bld.board_age_ms));
+    int passed = 0;
+
+    if (!pet_fits(ele, bld.min_weight)) return NULL;
+    list_for_each_entry_continue(pos, &flo->pets_waiting, list) {
+        if (dir && pet_heading(pos) != dir) continue;
+        if (pet_fits(ele, pos->weight)) return pos;
+        if (!bld.board_fill || !ktime_after(pos->enqueue_time, aged) || ++passed > BOARD_LOOKAHEAD)
+            return NULL;
+    }
+    return NULL;
+}
+
+// Whether anyone in flo's queue heading dir could board right now.
+static bool anyone_fits(struct elevator* ele, struct floor* flo, int dir) {
+    bool fits;
+
+    lock_floor(flo);
+    // Scanning starts after the list head.
+    fits = next_boarder(ele, flo, list_entry(&flo->pets_waiting, struct pet, list), dir,
+                        elevator_now()) != NULL;
+    mutex_unlock(&flo->lock);
+    return fits;
+}
+
+// Floors set in a or b, counted without a scratch bitmap.
+static int union_weight(const unsigned long* a, const unsigned long* b, int nbits) {
+    int w = 0;
+    int i;
+
+    for (i = 0; i < BITS_TO_LONGS(nbits); ++i)
+        w += hweight_long(a[i] | b[i]);
+    return w;
+}
+
+// Rough seconds until ele could open its doors at floor: 2s a floor,
+// running out to its furthest planned stop first when floor is behind
+// it, 1s for every other stop it has planned, and one more trip across
+// the building when it is full. Reads the car without its lock.
+static int car_eta(struct elevator* ele, int floor) {
+    int n = bld.nr_floors;
+    int cur = READ_ONCE(ele->current_floor);
+    int dir = READ_ONCE(ele->direction);
+    int stops, dist, turn;
+    int eta;
+
+    stops = union_weight(ele->dest_floors, ele->claimed, n);
+    if (test_bit(floor - 1, ele->dest_floors) || test_bit(floor - 1, ele->claimed))
+        stops--;
+    if (!stops || (floor - cur) * dir >= 0) {
+        dist = abs(floor - cur);
+    } else if (dir > 0) {
+        unsigned long d = find_last_bit(ele->dest_floors, n);
+        unsigned long c = find_last_bit(ele->claimed, n);
+
+        // find_last_bit returns n for an empty map
+        turn = max(d < n ? (int)d : -1, c < n ? (int)c : -1) + 1;
+        dist = abs(turn - cur) + abs(turn - floor);
+    } else {
+        turn = min(find_first_bit(ele->dest_floors, n), find_first_bit(ele->claimed, n)) + 1;
+        dist = abs(turn - cur) + abs(turn - floor);
+    }
+    eta = dist * 2 + stops;
+    if (!pet_fits(ele, bld.min_weight))
+        eta += 2 * n;
+    return eta;
+}
+
+// The dispatcher: hand flo to the car that can reach it soonest, ties
+// going to the lowest numbered car. Each waiting floor belongs to exactly
+// one car, so two cars never head for the same pickup. Called with
+// flo->lock held; returns the car to wake if the floor changed hands.
+static struct elevator* assign_floor(struct floor* flo) {
+    struct elevator* all = READ_ONCE(cars);
+    int idx = flo->floor_num - 1;
+    int best = -1, best_eta = INT_MAX;
+    int i;
+
+    if (!all) return NULL;
+    for (i = 0; i < nr_cars; ++i) {
+        int eta = car_eta(&all[i], flo->floor_num);
+
+        if (eta < best_eta) {
+            best_eta = eta;
+            best = i;
+        }
+    }
+    if (best == flo->car) return NULL;
+
+    if (flo->car >= 0)
+        clear_bit(idx, all[flo->car].claimed);
+    flo->car = best;
+    set_bit(idx, all[best].claimed);
+    return &all[best];
+}
+
+// Give up flo's claim once nobody is left waiting. Called with flo->lock held.
+static void release_floor(struct floor* flo) {
+    if (flo->car < 0) return;
+    clear_bit(flo->floor_num - 1, cars[flo->car].claimed);
+    flo->car = -1;
+}
+
+// An idle car re-runs the dispatcher over every waiting floor, taking over
+// those it can now reach before their current car. Returns whether it has
+// anything to do.
+static bool claim_waiting_floors(struct elevator* ele) {
+    unsigned long i;
+
+    for_each_set_bit(i, waiting_floors, bld.nr_floors) {
+        struct floor* flo = &floors[i];
+        struct elevator* wake = NULL;
+
+        lock_floor(flo);
+        if (!list_empty(&flo->pets_waiting))
+            wake = assign_floor(flo);
+        mutex_unlock(&flo->lock);
+        if (wake && wake != ele)
+            wake_elevator(wake);
+    }
+    return !bitmap_empty(ele->claimed, bld.nr_floors);
+}
+
+// While any of the car's pickups has high priority pets, the others wait,
+// unless a normal pet there has waited prio_age_ms. Riders still get off
+// on the way.
+static void favor_high_floors(struct elevator* ele) {
+    ktime_t aged;
+    unsigned long i;
+
+    for_each_set_bit(i, ele->claimed, bld.nr_floors)
+        if (test_bit(i, waiting_high) && test_bit(i, ele->work_floors)) break;
+    if (i >= bld.nr_floors) return;
+
+    aged = ktime_sub(elevator_now(), ms_to_ktime(bld.prio_age_ms));
+    for_each_set_bit(i, ele->claimed, bld.nr_floors) {
+        if (test_bit(i, waiting_high) || test_bit(i, ele->dest_floors)) continue;
+        if (!ktime_after(READ_ONCE(floors[i].normal_since), aged)) continue;
+        __clear_bit(i, ele->work_floors);
+    }
+}
+
+// Floors where a stop would let someone off or on. The car's claimed
+// floors count while it has room for the lightest pet. The current floor
+// is checked exactly so the car never stops there for nothing, and so is
+// every claimed floor once the car has riders: a loaded car chasing
+// floors where nobody fits would never get its riders home.
+static void update_work_floors(struct elevator* ele) {
+    int idx = ele->current_floor - 1;
+    unsigned long i;
+
+    bitmap_copy(ele->work_floors, ele->dest_floors, bld.nr_floors);
+    if (!pet_fits(ele, bld.min_weight)) return;
+    bitmap_or(ele->work_floors, ele->work_floors, ele->claimed, bld.nr_floors);
+    for_each_set_bit(i, ele->claimed, bld.nr_floors) {
+        if (i != idx && !ele->num_of_pets) continue;
+        if (!test_bit(i, ele->dest_floors) && !anyone_fits(ele, &floors[i], 0))
+            __clear_bit(i, ele->work_floors);
+    }
+    favor_high_floors(ele);
+}
+
+// Open the doors at the current floor: riders get off, then waiting pets
+// heading dir board (any direction for dir 0).
+static void stop_at_floor(struct elevator* ele, int dir) {
+    struct floor* flo = &floors[ele->current_floor - 1];
+
+    set_elevator_state(ele, ELEVATOR_LOADING);
+    dispense_pets_from_elevator(ele);
+    if (atomic_read(&flo->num_waiting))
+        add_pet_to_elevator(ele, flo, dir);
+    if (ele->num_of_pets)
+        record_trip(ele);
+}
+
+// Stop on the way only if someone gets off here, or this is one of our
+// floors and a pet here going our way fits. Stops where the doors
+// would open for nobody are skipped.
+static bool stop_en_route(struct elevator* ele, int dir) {
+    int idx = ele->current_floor - 1;
+
+    if (test_bit(idx, ele->dest_floors)) return true;
+    if (!test_bit(idx, ele->claimed)) return false;
+    if (!test_bit(idx, dir > 0 ? waiting_up : waiting_down)) return false;
+    return anyone_fits(ele, &floors[idx], dir);
+}
+
+// The closest floor with work from floor from onwards in direction dir,
+// from itself included, or 0 if there is none.
+static int next_work_floor(struct elevator* ele, int from, int dir) {
+    unsigned long f;
+
+    if (dir > 0) {
+        f = find_next_bit(ele->work_floors, bld.nr_floors, from - 1);
+        return f < bld.nr_floors ? f + 1 : 0;
+    }
+    f = find_last_bit(ele->work_floors, from);
+    return f < from ? f + 1 : 0;
+}
+
+// The furthest floor with work strictly beyond the current one in
+// direction dir, or 0 if there is none.
+static int last_work_floor(struct elevator* ele, int dir) {
+    unsigned long f;
+
+    if (dir > 0) {
+        f = find_last_bit(ele->work_floors, bld.nr_floors);
+        return (f < bld.nr_floors && f + 1 > ele->current_floor) ? f + 1 : 0;
+    }
+    f = find_first_bit(ele->work_floors, bld.nr_floors);
+    return (f < bld.nr_floors && f + 1 < ele->current_floor) ? f + 1 : 0;
+}
+
+// LOOK: head for the last floor with work ahead, picking up pets going the
+// same way on the way there, then turn around.
+static int look_pick_next_floor(struct elevator* ele) {
+    int target = last_work_floor(ele, ele->direction);
+
+    if (!target) {
+        ele->direction = -ele->direction;
+        target = last_work_floor(ele, ele->direction);
+    }
+    if (!target && test_bit(ele->current_floor - 1, ele->work_floors))
+        target = ele->current_floor;
+    return target;
+}
+
+// SCAN: sweep all the way to the end floor before turning around.
+static int scan_pick_next_floor(struct elevator* ele) {
+    int end;
+
+    if (bitmap_empty(ele->work_floors, bld.nr_floors)) return 0;
+    end = ele->direction > 0 ? bld.nr_floors : 1;
+    if (end == ele->current_floor) {
+        ele->direction = -ele->direction;
+        end = ele->direction > 0 ? bld.nr_floors : 1;
+    }
+    return end;
+}
+
+static void scan_on_arrival(struct elevator* ele) {
+    if (ele->current_floor == bld.nr_floors) ele->direction = -1;
+    else if (ele->current_floor == 1) ele->direction = 1;
+}
+
+// Nearest-first: the closest floor with work wins; ties keep the current
+// direction of travel.
+static int nearest_pick_next_floor(struct elevator* ele) {
+    int cur = ele->current_floor;
+    int up = next_work_floor(ele, cur, 1);
+    int down = next_work_floor(ele, cur, -1);
+
+    if (!up || !down) return up ? up : down;
+    if (up - cur != cur - down) return (up - cur < cur - down) ? up : down;
+    return ele->direction > 0 ? up : down;
+}
+
+// FIFO: carry the earliest boarded pet to its floor, dropping others off
+// on the way but picking nobody up. An empty car fetches the pet that has
+// waited longest among its floors.
+static int fifo_pick_next_floor(struct elevator* ele) {
+    struct pet* first = list_first_entry_or_null(&ele->pet_list, struct pet, car_list);
+    ktime_t oldest = KTIME_MAX;
+    int target = 0;
+    unsigned long i;
+
+    if (first) return first->destination_floor;
+
+    for_each_set_bit(i, ele->claimed, bld.nr_floors) {
+        struct floor* flo = &floors[i];
+        struct pet* head;
+
+        lock_floor(flo);
+        head = list_first_entry_or_null(&flo->pets_waiting, struct pet, list);
+        if (head && ktime_before(head->enqueue_time, oldest)) {
+            oldest = head->enqueue_time;
+            target = i + 1;
+        }
+        mutex_unlock(&flo->lock);
+    }
+    return target;
+}
+
+static bool fifo_should_stop_here(struct elevator* ele, int dir) {
+    return test_bit(ele->current_floor - 1, ele->dest_floors);
+}
+
+static const struct elevator_sched look_sched = {
+    .name = "look",
+    .pick_next_floor = look_pick_next_floor,
+    .should_stop_here = stop_en_route,
+};
+
+static const struct elevator_sched scan_sched = {
+    .name = "scan",
+    .pick_next_floor = scan_pick_next_floor,
+    .should_stop_here = stop_en_route,
+    .on_arrival = scan_on_arrival,
+};
+
+static const struct elevator_sched nearest_sched = {
+    .name = "nearest",
+    .pick_next_floor = nearest_pick_next_floor,
+    .should_stop_here = stop_en_route,
+};
+
+static const struct elevator_sched fifo_sched = {
+    .name = "fifo",
+    .pick_next_floor = fifo_pick_next_floor,
+    .should_stop_here = fifo_should_stop_here,
+};
+
+const struct elevator_sched* const scheds[NR_POLICIES] = {
+    [POLICY_LOOK] = &look_sched,
+    [POLICY_SCAN] = &scan_sched,
+    [POLICY_NEAREST] = &nearest_sched,
+    [POLICY_FIFO] = &fifo_sched,
+};
+
+// The policy can be changed at any time; each car picks it up
+// at its next decision. Time already run is charged to the old policy.
+int elevator_set_policy(const char* name) {
+    int i;
+
+    for (i = 0; i < NR_POLICIES; ++i) {
+        if (!sysfs_streq(name, scheds[i]->name)) continue;
+        spin_lock(&stats_lock);
+        account_sched_time(elevator_now());
+        WRITE_ONCE(sched_policy, i);
+        spin_unlock(&stats_lock);
+        return 0;
+    }
+    return -EINVAL;
+}
+
+
+// Normal pets are queued in arrival order, so the first one left is the
+// oldest. Called with flo->lock held.
+static void update_normal_since(struct floor* flo) {
+    struct pet* entry;
+    ktime_t since = KTIME_MAX;
+
+    list_for_each_entry(entry, &flo->pets_waiting, list) {
+        if (entry->priority == ELEVATOR_PRIO_NORMAL) {
+            since = entry->enqueue_time;
+            break;
+        }
+    }
+    WRITE_ONCE(flo->normal_since, since);
+}
+
+// Board pets from flo in queue order until one does not fit. With dir set
+// only pets heading that way are considered; the others keep their place.
+static void add_pet_to_elevator(struct elevator* pet_elevator, struct floor* flo, int dir) {
+    struct pet* new_pet, *prev;
+    struct elevator* wake = NULL;
+    bool normal_boarded = false;
+    int boarded = 0;
+    ktime_t now = elevator_now();
+
+    lock_floor(flo);
+    
+    prev = list_entry(&flo->pets_waiting, struct pet, list);
+    while ((new_pet = next_boarder(pet_elevator, flo, prev, dir, now))) {
+        // Pets passed over stay in place, so the scan resumes after them.
+        prev = list_entry(new_pet->list.prev, struct pet, list);
+        list_del(&new_pet->list);
+        atomic_dec(&flo->num_waiting);
+        boarded++;
+        if (pet_heading(new_pet) > 0) flo->num_up--;
+        else flo->num_down--;
+        if (new_pet->priority == ELEVATOR_PRIO_HIGH) flo->num_high--;
+        else normal_boarded = true;
+        record_boarding(new_pet);
+        emit_pet_event(ELEVATOR_EV_BOARD, pet_elevator, new_pet, flo->floor_num);
+        trace_elevator_board(pet_elevator->id + 1, new_pet->id, new_pet->pet_type, flo->floor_num,
+                             new_pet->destination_floor,
+                             ktime_to_ns(ktime_sub(new_pet->board_time, new_pet->enqueue_time)));
+        elevator_dbg("car %d: added pet to elevator\n", pet_elevator->id + 1);
+        
+        list_add_tail(&new_pet->list, &pet_elevator->dest_pets[new_pet->destination_floor - 1]);
+        list_add_tail(&new_pet->car_list, &pet_elevator->pet_list);
+        __set_bit(new_pet->destination_floor - 1, pet_elevator->dest_floors);
+        pet_elevator->num_of_pets += 1;
+        pet_elevator->current_weight += new_pet->weight;
+        pet_elevator->dest_count[new_pet->destination_floor - 1]++;
+    }
+
+    // Whoever is left behind goes back to the dispatcher, which may find
+    // a car with more room.
+    if (list_empty(&flo->pets_waiting)) {
+        clear_bit(flo->floor_num - 1, waiting_floors);
+        release_floor(flo);
+    } else {
+        wake = assign_floor(flo);
+    }
+    if (!flo->num_up)
+        clear_bit(flo->floor_num - 1, waiting_up);
+    if (!flo->num_down)
+        clear_bit(flo->floor_num - 1, waiting_down);
+    if (!flo->num_high)
+        clear_bit(flo->floor_num - 1, waiting_high);
+    if (normal_boarded)
+        update_normal_since(flo);
+    publish_floor_snapshot(flo);
+    mutex_unlock(&flo->lock);
+    unadmit_pets(flo, boarded);
+    publish_car_snapshot(pet_elevator);
+    if (wake && wake != pet_elevator)
+        wake_elevator(wake);
+}
+
+static void init_pet(struct pet* new_pet, int type, int start_floor, int dest_floor, ktime_t now) {
+    new_pet->id = atomic64_inc_return(&next_pet_id);
+    new_pet->destination_floor = dest_floor;
+    new_pet->starting_floor = start_floor;
+    new_pet->priority = ELEVATOR_PRIO_NORMAL;
+    new_pet->enqueue_time = now;
+    new_pet->board_time = 0;
+    new_pet->session = NULL;
+
+    new_pet->pet_type = type;
+    new_pet->weight = bld.weights[type];
+}
+
+// Rebuild the floor's snapshot from the head of its queue. Called with
+// flo->lock held.
+static void publish_floor_snapshot(struct floor* flo) {
+    struct pet* entry;
+    int n = 0;
+
+    write_seqcount_begin(&flo->seq);
+    list_for_each_entry(entry, &flo->pets_waiting, list) {
+        if (n == FLOOR_PREVIEW) break;
+        flo->snap_pets[n].type = entry->pet_type;
+        flo->snap_pets[n].dest = entry->destination_floor;
+        n++;
+    }
+    flo->snap_len = n;
+    flo->snap_count = atomic_read(&flo->num_waiting);
+    write_seqcount_end(&flo->seq);
+}
+
+// Copy up to max pets of flo's queue from cur into out and move cur past
+// them; *more is set if any are left behind them. Only holds flo->lock for
+// one walk of the queue, so a long listing is read a piece at a time.
+// Called inside elevator_srcu.
+int elevator_floor_pets(struct floor* flo, struct floor_cursor* cur, struct pet_brief* out, int max, bool* more) {
+    struct list_head* pos = NULL;
+    struct pet* entry;
+    u64 last = 0;
+    int i = 0, at = cur->at, n = 0;
+
+    lock_floor(flo);
+    list_for_each_entry(entry, &flo->pets_waiting, list) {
+        if (cur->id && entry->id == cur->id) {
+            pos = entry->list.next;
+            at = i + 1;
+            break;
+        }
+        if (i == cur->at && !pos) {
+            pos = &entry->list;
+            if (!cur->id) break;
+        }
+        ++i;
+    }
+    for (; pos && pos != &flo->pets_waiting && n < max; pos = pos->next, ++n) {
+        entry = list_entry(pos, struct pet, list);
+        out[n].type = entry->pet_type;
+        out[n].dest = entry->destination_floor;
+        last = entry->id;
+    }
+    *more = pos && pos != &flo->pets_waiting;
+    mutex_unlock(&flo->lock);
+
+    if (n) {
+        cur->id = last;
+        cur->at = at + n;
+    }
+    return n;
+}
+
+// Queue p behind every pet of its class or higher, and behind normal
+// pets that have waited prio_age_ms. Normal pets always go to the back.
+// Called with flo->lock held.
+static void queue_by_priority(struct floor* flo, struct pet* p) {
+    ktime_t aged = ktime_sub(p->enqueue_time, ms_to_ktime(bld.prio_age_ms));
+    struct list_head* pos = flo->pets_waiting.prev;
+
+    while (pos != &flo->pets_waiting) {
+        struct pet* ahead = list_entry(pos, struct pet, list);
+
+        if (ahead->priority >= p->priority || !ktime_after(ahead->enqueue_time, aged)) break;
+        pos = pos->prev;
+    }
+    list_move(&p->list, pos);
+}
+
+// Only the target floor is locked, so requests for different floors
+// never contend with each other. Called inside elevator_srcu.
+static void enqueue_pets(struct floor* flo, struct list_head* pets, int count) {
+    struct elevator* wake = NULL;
+    struct pet* entry, *next;
+    ktime_t since = KTIME_MAX;
+    int up = 0, high = 0;
+
+    list_for_each_entry(entry, pets, list) {
+        emit_pet_event(ELEVATOR_EV_ENQUEUE, NULL, entry, flo->floor_num);
+        trace_elevator_enqueue(entry->id, entry->pet_type, flo->floor_num, entry->destination_floor);
+        if (pet_heading(entry) > 0) up++;
+        if (entry->priority == ELEVATOR_PRIO_HIGH) high++;
+        else if (since == KTIME_MAX) since = entry->enqueue_time;
+    }
+
+    lock_floor(flo);
+    if (!high) {
+        // New pets go to the back of the queue, so the snapshot only
+        // needs them appended while it still has room.
+        write_seqcount_begin(&flo->seq);
+        list_for_each_entry(entry, pets, list) {
+            if (flo->snap_len == FLOOR_PREVIEW) break;
+            flo->snap_pets[flo->snap_len].type = entry->pet_type;
+            flo->snap_pets[flo->snap_len].dest = entry->destination_floor;
+            flo->snap_len++;
+        }
+        flo->snap_count += count;
+        write_seqcount_end(&flo->seq);
+        list_splice_tail_init(pets, &flo->pets_waiting);
+        atomic_add(count, &flo->num_waiting);
+    } else {
+        list_for_each_entry_safe(entry, next, pets, list)
+            queue_by_priority(flo, entry);
+        atomic_add(count, &flo->num_waiting);
+        publish_floor_snapshot(flo);
+        flo->num_high += high;
+        set_bit(flo->floor_num - 1, waiting_high);
+    }
+    if (since != KTIME_MAX && flo->normal_since == KTIME_MAX)
+        WRITE_ONCE(flo->normal_since, since);
+    record_demand(flo, count);
+    if (atomic_read(&flo->num_waiting) > flo->waiting_max)
+        flo->waiting_max = atomic_read(&flo->num_waiting);
+    raise_max(&total_admitted_max, atomic_read(&total_admitted));
+    flo->num_up += up;
+    flo->num_down += count - up;
+    if (up)
+        set_bit(flo->floor_num - 1, waiting_up);
+    if (count - up)
+        set_bit(flo->floor_num - 1, waiting_down);
+    set_bit(flo->floor_num - 1, waiting_floors);
+    if (flo->car < 0)
+        wake = assign_floor(flo);
+    mutex_unlock(&flo->lock);
+
+    if (wake)
+        wake_elevator(wake);
+}
+
+// Queue the next step of a sleeping car. A car that is busy, or waiting
+// out a delay, looks for its new floors by itself.
+static void wake_elevator(struct elevator* ele) {
+    if (!READ_ONCE(sim_scale)) {
+        sim_unblock(ele);
+        return;
+    }
+    if (atomic_xchg(&ele->asleep, 0))
+        queue_work(car_wq, &ele->work);
+}
+
+// Returns 1 for a request that is out of range for the running building,
+// -ENODEV while the elevator is stopped, -EAGAIN when the queues are full
+// and -ENOMEM if the pet could not be allocated.
+static int add_pet_to_floor(int type, int start_floor, int dest_floor) {
+    LIST_HEAD(one);
+    struct floor* all;
+    struct pet* new_pet;
+    int srcu_idx;
+    int ret;
+
+    srcu_idx = srcu_read_lock(&elevator_srcu);
+    all = smp_load_acquire(&floors);
+    ret = -ENODEV;
+    if (!all) goto out;
+    ret = 1;
+    if (!valid_request(start_floor, dest_floor, type)) goto out;
+
+    ret = admit_pets(&all[start_floor - 1], 1);
+    if (ret) {
+        atomic64_inc(&rejected_requests);
+        goto out;
+    }
+    new_pet = kmem_cache_alloc(pet_cache, GFP_KERNEL);
+    if (!new_pet) {
+        unadmit_pets(&all[start_floor - 1], 1);
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    init_pet(new_pet, type, start_floor, dest_floor, elevator_now());
+    record_pets((void**)&new_pet, 1);
+
+    list_add_tail(&new_pet->list, &one);
+    enqueue_pets(&all[start_floor - 1], &one, 1);
+    elevator_dbg("pet has been added to floor %d\n", start_floor);
+out:
+    srcu_read_unlock(&elevator_srcu, srcu_idx);
+    return ret;
+}
+
+void read_car_snapshot(struct elevator* ele, struct car_snapshot* snap) {
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&ele->seq);
+        *snap = ele->snap;
+    } while (read_seqcount_retry(&ele->seq, seq));
+}
+
+static int init_event_ring(void) {
+    u32 nr_events = EVENT_RING_PAGES * PAGE_SIZE / sizeof(struct elevator_event);
+
+    BUILD_BUG_ON(sizeof(struct elevator_ring_header) > PAGE_SIZE);
+    event_ring_size = (1 + EVENT_RING_PAGES) * PAGE_SIZE;
+    event_ring = vmalloc_user(event_ring_size);
+    if (!event_ring) return -ENOMEM;
+
+    event_ring->magic = ELEVATOR_RING_MAGIC;
+    event_ring->version = ELEVATOR_RING_VERSION;
+    event_ring->nr_events = rounddown_pow_of_two(nr_events);
+    event_ring->event_size = sizeof(struct elevator_event);
+    event_ring->data_offset = PAGE_SIZE;
+    event_ring->head = 0;
+    return 0;
+}
+
+void elevator_read_stats(struct elevator_stats* st) {
+    spin_lock(&stats_lock);
+    st->dispatch_samples = dispatch_samples;
+    st->dispatch_total_ns = dispatch_total_ns;
+    st->dispatch_max_ns = dispatch_max_ns;
+    st->trips = trips;
+    st->trip_load_total = trip_load_total;
+    st->trip_pets_total = trip_pets_total;
+    st->lock_hold_samples = lock_hold_samples;
+    st->lock_hold_total_ns = lock_hold_total_ns;
+    st->lock_hold_max_ns = lock_hold_max_ns;
+    st->max_weight = bld.max_weight;
+    st->max_waiting = bld.max_waiting;
+    st->max_floor_waiting = bld.max_floor_waiting;
+    st->waiting = atomic_read(&total_admitted);
+    st->waiting_max = atomic_read(&total_admitted_max);
+    st->rejected = atomic64_read(&rejected_requests);
+    account_sched_time(elevator_now());
+    memcpy(st->per_policy, sched_stats, sizeof(st->per_policy));
+    memcpy(st->per_class, class_stats, sizeof(st->per_class));
+    st->policy = sched_policy;
+    spin_unlock(&stats_lock);
+    st->time_scale = READ_ONCE(sim_scale);
+}
+
+// The time under which q percent of a histogram's samples fall, rounded up
+// to the end of their bucket; the last bucket has no end and counts as
+// twice the one before. 0 for an empty histogram.
+u64 elevator_hist_quantile_ms(const u64* hist, int nr, int q) {
+    u64 total = 0, want, seen = 0;
+    int i;
+
+    for (i = 0; i < nr; ++i)
+        total += hist[i];
+    if (!total) return 0;
+    want = div64_u64(total * q + 99, 100);
+    for (i = 0; i < nr - 1; ++i) {
+        seen += hist[i];
+        if (seen >= want) break;
+    }
+    return 1ULL << i;
+}
+
+// The same for a class, never past its longest wait.
+u64 elevator_wait_quantile_ms(const struct class_stats* cs, int q) {
+    return min(elevator_hist_quantile_ms(cs->hist, WAIT_HIST_BUCKETS, q),
+               div_u64(cs->wait_max_ns, NSEC_PER_MSEC));
+}
+
+// Add up flo's per-CPU counts. Called inside elevator_srcu.
+void elevator_read_latency(struct floor* flo, struct floor_latency* out) {
+    int cpu, k, i;
+
+    memset(out, 0, sizeof(*out));
+    for_each_possible_cpu(cpu) {
+        struct floor_latency_pcpu* l = per_cpu_ptr(flo->latency, cpu);
+
+        for (k = 0; k < NR_LAT_KINDS; ++k)
+            for (i = 0; i < LATENCY_BUCKETS; ++i)
+                out->hist[k][i] += READ_ONCE(l->hist[k][i]);
+    }
+}
+
+// Counts taken while this runs may survive it.
+void elevator_reset_latency(void) {
+    struct floor* all;
+    int srcu_idx;
+    int cpu, i;
+
+    srcu_idx = srcu_read_lock(&elevator_srcu);
+    all = smp_load_acquire(&floors);
+    for (i = 0; all && i < bld.nr_floors; ++i)
+        for_each_possible_cpu(cpu)
+            memset(per_cpu_ptr(all[i].latency, cpu), 0, sizeof(struct floor_latency_pcpu));
+    srcu_read_unlock(&elevator_srcu, srcu_idx);
+}
+
+int elevator_core_init(void) {
+    pet_cache = kmem_cache_create(PET_CACHE_NAME, sizeof(struct pet), 0, PET_CACHE_FLAGS, NULL);
+    if (pet_cache == NULL) return -ENOMEM;
+    car_wq = alloc_workqueue("elevator", WQ_UNBOUND, 0);
+    if (!car_wq) goto err_cache;
+    INIT_WORK(&park_work, park_work_fn);
+    hrtimer_setup(&park_timer, park_timer_fn, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    seqcount_mutex_init(&park_plan.seq, &park_mutex);
+    if (init_event_ring()) goto err_wq;
+    return 0;
+
+err_wq:
+    destroy_workqueue(car_wq);
+err_cache:
+    kmem_cache_destroy(pet_cache);
+    return -ENOMEM;
+}
+
+// The elevator must be stopped.
+void elevator_core_exit(void) {
+    destroy_workqueue(car_wq);
+    kvfree(park_demand);
+    kvfree(record_log);
+    vfree(event_ring);
+    kmem_cache_destroy(pet_cache);
+}
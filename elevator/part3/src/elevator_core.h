@@ -0,0 +1,326 @@
+#ifndef __ELEVATOR_CORE_H
+#define __ELEVATOR_CORE_H
+
+// The elevator itself: pet queues, boarding, dispensing, dispatch and the
+// car steps. elevator_core.c builds into the module next to the glue in
+// elevator_main.c, and into libelevator in sim/ on top of the pthread shims
+// in sim/kcompat.h.
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/atomic.h>
+#include <linux/seqlock.h>
+#include <linux/srcu.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#else
+#include "sim/kcompat.h"
+#endif
+
+#include "elevator_uapi.h"
+
+#define FLOOR_PREVIEW 128 // waiting pets listed per floor in /proc/elevator
+#define MAX_CARS 16
+#define MAX_FLOORS 1024
+#define MAX_CAPACITY 32 // pets per car
+#define MAX_PET_TYPES 16
+#define MAX_RECORDED_REQUESTS (1 << 22) // 64 MiB of trace records
+
+// The geometry the elevator was last started with. elevator_start fills it
+// in before publishing the floors, so anyone who sees the floors under
+// elevator_srcu sees a matching building; it does not change until the
+// next start.
+struct building
+{
+    int nr_floors;
+    int capacity; // pets per car
+    int max_weight; // lbs per car
+    int min_weight; // the lightest pet type
+    // Queue limits; a request past either one fails with -EAGAIN. 0 for
+    // no limit.
+    int max_waiting; // pets waiting over all floors
+    int max_floor_waiting; // pets waiting at one floor
+    // Let pets that fit board past one that does not, until it has waited
+    // board_age_ms.
+    bool board_fill;
+    int board_age_ms;
+    // High priority pets stop overtaking a normal one, and cars stop
+    // putting its floor last, once it has waited prio_age_ms.
+    int prio_age_ms;
+    // Send idle cars to where the next pickup is most likely.
+    bool park;
+    int nr_types;
+    int weights[MAX_PET_TYPES];
+    char letters[MAX_PET_TYPES];
+};
+
+enum dispatch_policy {
+    POLICY_LOOK = 0,
+    POLICY_SCAN,
+    POLICY_NEAREST,
+    POLICY_FIFO,
+    NR_POLICIES,
+};
+
+struct pet
+{
+    u64 id; // identifies the pet in the event ring
+    struct list_head list; // floor queue while waiting, destination bucket once boarded
+    struct list_head car_list; // elevator->pet_list, in boarding order
+    int pet_type; // index into bld.weights, 0 = chihuahua, 1 = pug, 2 = pughuahua, 3 = doxen by default
+    int weight;
+    int starting_floor;
+    int destination_floor;
+    int priority; // ELEVATOR_PRIO_*
+    ktime_t enqueue_time; // when issue_request queued the pet
+    ktime_t board_time; // 0 until boarded
+    ktime_t done_time;
+    // Set for pets submitted through /dev/elevator_requests, which come
+    // back to their session once delivered or dropped.
+    struct elevator_session* session;
+    u64 user_data;
+    int status; // for the completion
+};
+// One open /dev/elevator_requests. Pets submitted through it are put on
+// done when they are delivered, or cancelled by elevator_stop, until the
+// file reads them.
+struct elevator_session
+{
+    spinlock_t lock;
+    struct list_head done; // completed pets, under lock
+    bool closed; // under lock
+    atomic_t refs; // the file plus every pet still in the building
+    wait_queue_head_t wait; // readers and pollers wait for done
+};
+// Wait and ride times of the pets that started (FROM) or ended (TO)
+// their trip at a floor, bucketed like class_stats.hist. Counted per CPU
+// so cars on different CPUs never share a cache line for them.
+#define LATENCY_BUCKETS 24 // the last one takes everything from 2^22 ms (70 min)
+enum latency_kind {
+    LAT_WAIT_FROM = 0,
+    LAT_RIDE_FROM,
+    LAT_WAIT_TO,
+    LAT_RIDE_TO,
+    NR_LAT_KINDS,
+};
+struct floor_latency_pcpu
+{
+    u32 hist[NR_LAT_KINDS][LATENCY_BUCKETS];
+};
+// The per-CPU counts of one floor added up.
+struct floor_latency
+{
+    u64 hist[NR_LAT_KINDS][LATENCY_BUCKETS];
+};
+// Arrivals at a floor in one hour of the day, in PARK_HEAT_ONE units.
+// Each day that goes by keeps 3/4 of the heat. Kept from one run to the
+// next; written under the floor's lock, read without it.
+#define PARK_BUCKETS 24
+#define PARK_HEAT_ONE 16
+struct park_cell
+{
+    u32 heat;
+    u32 day; // the day heat was last brought up to date
+};
+// A floor with recent demand, as seen when planning where idle cars wait.
+struct park_point
+{
+    int floor;
+    u32 weight;
+    int cover; // floors to the nearest car already placed, INT_MAX if none
+};
+// Just enough of a pet to print it in /proc/elevator.
+struct pet_brief
+{
+    u8 type;
+    u16 dest;
+};
+// Where elevator_floor_pets carries on: after the pet with id, or at
+// position at if that pet has left the queue. {0, at} starts at at.
+struct floor_cursor
+{
+    u64 id;
+    int at;
+};
+struct floor
+{
+    // High priority pets first, each class in arrival order, except that
+    // no pet is queued ahead of a normal one that has waited prio_age_ms.
+    struct list_head pets_waiting;
+    struct mutex lock;
+    atomic_t num_waiting; // length of pets_waiting, readable without the lock
+    // Pets counted against the queue limits: waiting, or admitted and
+    // about to be queued. Dropped again when they board.
+    atomic_t admitted;
+    int waiting_max; // high-water mark of num_waiting, under lock
+    struct floor_latency_pcpu __percpu* latency;
+    int num_up; // waiting pets heading up, under lock
+    int num_down; // waiting pets heading down, under lock
+    int num_high; // waiting high priority pets, under lock
+    ktime_t normal_since; // oldest waiting normal pet's enqueue_time or KTIME_MAX; written under lock
+    int floor_num;
+    int car; // index of the car assigned to pick up here, -1 if none; under lock
+    bool elevator_at_floor;
+    // Published for /proc/elevator; rewritten under lock, read locklessly.
+    seqcount_mutex_t seq;
+    int snap_count;
+    int snap_len; // min(snap_count, FLOOR_PREVIEW)
+    struct pet_brief snap_pets[FLOOR_PREVIEW];
+};
+// The car as /proc/elevator shows it, published by the car's steps.
+struct car_snapshot
+{
+    enum elevator_state state;
+    int current_floor;
+    int load;
+    int num_of_pets;
+    int pets_serviced;
+    struct pet_brief pets[MAX_CAPACITY];
+};
+struct elevator
+{
+    int id; // index in cars[]
+    int current_floor;
+    int direction; // +1 or -1, the last direction of travel
+    int num_of_pets;
+    int current_weight; // running total of the weights in pet_list
+    // Per-floor state below is sized by bld.nr_floors.
+    int* dest_count; // pets on board per destination floor
+    unsigned long* dest_floors; // bit (floor - 1) set while dest_pets[floor - 1] is non-empty
+    struct list_head* dest_pets; // boarded pets bucketed by destination, linked through pet->list
+    unsigned long* claimed; // floors assigned to this car by assign_floor; atomic bitops
+    unsigned long* work_floors; // floors worth stopping at, refreshed before each dispatch decision
+    int pets_serviced;
+    // While idle with park set: the floor the car waits at or is heading
+    // for. 0 while it has work. Written under lock.
+    int park_floor;
+    u32 park_gen; // the parking plan park_floor was picked from
+    struct park_point* park; // scratch for pick_park_floor, nr_floors of them
+    enum elevator_state state;
+    struct mutex lock;
+    ktime_t locked_at; // ktime_get() when the current step took lock
+    // The car's steps run here, one at a time, queued by timer once a
+    // delay is over or by wake_elevator while the car sleeps.
+    struct work_struct work;
+    struct hrtimer timer;
+    atomic_t asleep; // 1 while no step is due and no timer is armed
+    struct list_head pet_list; // boarded pets in boarding order, linked through pet->car_list
+    seqcount_mutex_t seq; // guards snap, which is only written under lock
+    struct car_snapshot snap;
+    // With the virtual clock: 0 while the car runs, the time its delay
+    // ends, or KTIME_MAX while idle. Under sim_lock.
+    ktime_t sim_wake;
+};
+// A dispatch policy. Every op runs in a car step with ele->lock
+// held, after ele->work_floors has been refreshed.
+struct elevator_sched
+{
+    const char* name;
+    // Floor to head for, the current floor to stop here, or 0 to go idle.
+    // Pets waiting at the picked floor board whichever way they are going.
+    int (*pick_next_floor)(struct elevator* ele);
+    // Whether to stop at the current floor on the way to the picked floor,
+    // which lies in direction dir. Only pets heading dir board there.
+    bool (*should_stop_here)(struct elevator* ele, int dir);
+    // Called each time the car reaches a floor. Optional.
+    void (*on_arrival)(struct elevator* ele);
+};
+
+// Per-policy totals. Unlike the dispatch latency these survive a restart,
+// so the same workload can be run under each policy and compared.
+struct sched_stats
+{
+    u64 boarded;
+    u64 wait_total_ns;
+    u64 serviced;
+    u64 ride_total_ns;
+    u64 active_ns; // time the elevator has run under this policy
+};
+// Wait times per request class since the last start. hist[0] counts
+// waits under 1 ms, hist[i] those from 2^(i-1) ms to under 2^i ms, and
+// the last bucket everything longer.
+#define WAIT_HIST_BUCKETS 32
+struct class_stats
+{
+    u64 boarded;
+    u64 wait_total_ns;
+    u64 wait_max_ns;
+    u64 hist[WAIT_HIST_BUCKETS];
+};
+// Everything /proc/elevator_stats reports, copied out in one go.
+struct elevator_stats
+{
+    int time_scale;
+    int policy;
+    // Dispatch latency: time from issue_request to the pet being picked up.
+    u64 dispatch_samples;
+    u64 dispatch_total_ns;
+    u64 dispatch_max_ns;
+    // Departures from a stop with pets on board, and what they carried.
+    u64 trips;
+    u64 trip_load_total; // lbs
+    u64 trip_pets_total;
+    int max_weight;
+    // How long car steps held the car's lock, in real time.
+    u64 lock_hold_samples;
+    u64 lock_hold_total_ns;
+    u64 lock_hold_max_ns;
+    // Admission control since the last start.
+    int max_waiting;
+    int max_floor_waiting;
+    int waiting; // admitted over all floors
+    int waiting_max; // high-water mark of waiting
+    u64 rejected; // requests refused with -EAGAIN
+    struct sched_stats per_policy[NR_POLICIES];
+    struct class_stats per_class[ELEVATOR_NR_PRIO];
+};
+
+extern struct building bld;
+extern struct elevator* cars; // nr_cars of them while running
+extern int nr_cars;
+extern struct floor* floors; // bld.nr_floors of them while running
+// Producers and /proc readers hold this while they look at cars and
+// floors, so elevator_stop can wait them out before freeing.
+extern struct srcu_struct elevator_srcu;
+extern const struct elevator_sched* const scheds[NR_POLICIES];
+extern struct elevator_ring_header* event_ring;
+extern size_t event_ring_size;
+
+int elevator_core_init(void);
+void elevator_core_exit(void);
+int elevator_parse_pet_types(struct building* b, char* spec);
+int elevator_check_building(struct building* b);
+int elevator_start(const struct building* b, int n, int scale);
+int elevator_stop(void);
+int elevator_issue_request(int start_floor, int dest_floor, int type);
+int elevator_queue_requests(struct pet_request* reqs, void** scratch, int count);
+int elevator_set_policy(const char* name);
+void elevator_set_debug(bool on);
+void elevator_read_stats(struct elevator_stats* st);
+u64 elevator_wait_quantile_ms(const struct class_stats* cs, int q);
+u64 elevator_hist_quantile_ms(const u64* hist, int nr, int q);
+void elevator_read_latency(struct floor* flo, struct floor_latency* out);
+void elevator_reset_latency(void);
+int elevator_record(unsigned int cap);
+ssize_t elevator_read_trace(char __user* buf, size_t count, loff_t* pos);
+struct elevator_session* elevator_session_create(void);
+int elevator_session_submit(struct elevator_session* s, const struct elevator_submit* subs,
+                            void** scratch, int count);
+bool elevator_session_ready(struct elevator_session* s);
+int elevator_session_read(struct elevator_session* s, struct elevator_completion* out, int max);
+void elevator_session_close(struct elevator_session* s);
+ktime_t elevator_now(void);
+void elevator_clock_wait(ktime_t t);
+void elevator_clock_hold(void);
+void elevator_clock_release(void);
+void read_car_snapshot(struct elevator* ele, struct car_snapshot* snap);
+int elevator_floor_pets(struct floor* flo, struct floor_cursor* cur, struct pet_brief* out, int max, bool* more);
+
+#endif
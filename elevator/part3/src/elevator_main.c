@@ -0,0 +1,765 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/proc_fs.h>
+#include <linux/uaccess.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/seq_file.h>
+#include <linux/miscdevice.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+
+#include "elevator_core.h"
+
+// The module side of the elevator: parameters, syscall stubs, /proc files
+// and the event ring, trace and request devices. The elevator itself is in elevator_core.c.
+
+#define ENTRY_NAME "elevator"
+#define STATS_ENTRY_NAME "elevator_stats"
+#define LATENCY_ENTRY_NAME "elevator_latency"
+#define PERMS 0666
+// Writing "reset" clears the histograms, so only root may write it.
+#define LATENCY_PERMS 0644
+#define PARENT NULL
+
+extern int (*STUB_start_elevator)(void);
+extern int (*STUB_issue_request)(int,int,int);
+extern int (*STUB_issue_requests)(void __user*,int);
+extern int (*STUB_stop_elevator)(void);
+
+static struct proc_dir_entry* proc_entry;
+static struct proc_dir_entry* stats_entry;
+static struct proc_dir_entry* latency_entry;
+static int num_cars = 1;
+module_param_named(cars, num_cars, int, 0644);
+MODULE_PARM_DESC(cars, "Number of cars (1-16), applied by the next start_elevator");
+static int num_floors = 5;
+module_param_named(floors, num_floors, int, 0644);
+MODULE_PARM_DESC(floors, "Number of floors (2-1024), applied by the next start_elevator");
+static int capacity = 5;
+module_param(capacity, int, 0644);
+MODULE_PARM_DESC(capacity, "Pets per car (1-32), applied by the next start_elevator");
+static int max_weight = 50;
+module_param(max_weight, int, 0644);
+MODULE_PARM_DESC(max_weight, "Load limit of a car in lbs, applied by the next start_elevator");
+static int max_waiting;
+module_param(max_waiting, int, 0644);
+MODULE_PARM_DESC(max_waiting, "Pets allowed to wait over all floors before requests fail with EAGAIN, 0 for no limit; applied by the next start_elevator");
+static int max_floor_waiting;
+module_param(max_floor_waiting, int, 0644);
+MODULE_PARM_DESC(max_floor_waiting, "Pets allowed to wait at one floor before requests fail with EAGAIN, 0 for no limit; applied by the next start_elevator");
+static bool board_fill = true;
+module_param(board_fill, bool, 0644);
+MODULE_PARM_DESC(board_fill, "Let pets that fit board past one too heavy for the car, applied by the next start_elevator");
+static int board_age_ms = 120000;
+module_param(board_age_ms, int, 0644);
+MODULE_PARM_DESC(board_age_ms, "Simulated ms after which a waiting pet is no longer passed over by board_fill, applied by the next start_elevator");
+static int prio_age_ms = 60000;
+module_param(prio_age_ms, int, 0644);
+MODULE_PARM_DESC(prio_age_ms, "Simulated ms after which a normal pet is no longer passed over for high priority ones, applied by the next start_elevator");
+static bool park = true;
+module_param(park, bool, 0644);
+MODULE_PARM_DESC(park, "Send idle cars to the floor where pets are most likely to turn up at this time of day, applied by the next start_elevator");
+static char pet_types[128] = "C:3,P:14,H:10,D:16";
+module_param_string(pet_types, pet_types, sizeof(pet_types), 0644);
+MODULE_PARM_DESC(pet_types, "Pet types as letter:weight, comma separated; type n is the nth entry");
+static int time_scale = 1;
+module_param(time_scale, int, 0644);
+MODULE_PARM_DESC(time_scale, "Run the cars N times faster than real time, or 0 for a virtual clock that skips every delay; applied by the next start_elevator");
+
+static int sched_param_set(const char* val, const struct kernel_param* kp) {
+    return elevator_set_policy(val);
+}
+
+// Lists every policy with the active one in brackets.
+static int sched_param_get(char* buf, const struct kernel_param* kp) {
+    struct elevator_stats st;
+    int len = 0;
+    int i;
+
+    elevator_read_stats(&st);
+    for (i = 0; i < NR_POLICIES; ++i)
+        len += scnprintf(buf + len, PAGE_SIZE - len, i == st.policy ? "%s[%s]" : "%s%s",
+                         i ? " " : "", scheds[i]->name);
+    len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+    return len;
+}
+
+static const struct kernel_param_ops sched_param_ops = {
+    .set = sched_param_set,
+    .get = sched_param_get,
+};
+module_param_cb(sched, &sched_param_ops, NULL, 0644);
+MODULE_PARM_DESC(sched, "Dispatch policy: look (default), scan, nearest or fifo");
+
+static bool debug;
+
+static int debug_param_set(const char* val, const struct kernel_param* kp) {
+    bool on;
+    int ret;
+
+    ret = kstrtobool(val, &on);
+    if (ret) return ret;
+    elevator_set_debug(on);
+    *(bool*)kp->arg = on;
+    return 0;
+}
+
+static const struct kernel_param_ops debug_param_ops = {
+    .set = debug_param_set,
+    .get = param_get_bool,
+};
+module_param_cb(debug, &debug_param_ops, &debug, 0644);
+MODULE_PARM_DESC(debug, "Log what the cars do to the kernel log at KERN_DEBUG");
+
+static unsigned int record_cap;
+
+// Writing N starts a fresh recording of up to N requests, 0 stops it and
+// leaves what was recorded in /dev/elevator_trace.
+static int record_param_set(const char* val, const struct kernel_param* kp) {
+    unsigned int cap;
+    int ret;
+
+    ret = kstrtouint(val, 0, &cap);
+    if (ret) return ret;
+    ret = elevator_record(cap);
+    if (ret) return ret;
+    *(unsigned int*)kp->arg = cap;
+    return 0;
+}
+
+static const struct kernel_param_ops record_param_ops = {
+    .set = record_param_set,
+    .get = param_get_uint,
+};
+module_param_cb(record, &record_param_ops, &record_cap, 0644);
+MODULE_PARM_DESC(record, "Record up to N issued requests for replay from /dev/elevator_trace; 0 stops recording");
+
+// Read the geometry parameters for the next start.
+static int load_building(struct building* b) {
+    char spec[sizeof(pet_types)];
+    int ret;
+
+    b->nr_floors = READ_ONCE(num_floors);
+    b->capacity = READ_ONCE(capacity);
+    b->max_weight = READ_ONCE(max_weight);
+    b->max_waiting = READ_ONCE(max_waiting);
+    b->max_floor_waiting = READ_ONCE(max_floor_waiting);
+    b->board_fill = READ_ONCE(board_fill);
+    b->board_age_ms = READ_ONCE(board_age_ms);
+    b->prio_age_ms = READ_ONCE(prio_age_ms);
+    b->park = READ_ONCE(park);
+
+    kernel_param_lock(THIS_MODULE);
+    strscpy(spec, pet_types, sizeof(spec));
+    kernel_param_unlock(THIS_MODULE);
+    ret = elevator_parse_pet_types(b, spec);
+    if (ret) return ret;
+    return elevator_check_building(b);
+}
+
+static int start_elevator(void) {
+    struct building b;
+    int ret;
+
+    ret = load_building(&b);
+    if (ret) return ret;
+    return elevator_start(&b, READ_ONCE(num_cars), READ_ONCE(time_scale));
+}
+
+static int stop_elevator(void) {
+    return elevator_stop();
+}
+
+static int issue_request(int start_floor, int dest_floor, int type) {
+    return elevator_issue_request(start_floor, dest_floor, type);
+}
+
+// One copy in, one copy out with the per-entry status.
+static int issue_requests(void __user* ureqs, int count) {
+    struct pet_request* reqs;
+    int queued;
+
+    if (count <= 0 || count > MAX_BATCH_REQUESTS) return -EINVAL;
+
+    // The request copy and the pet pointer array share one allocation.
+    reqs = kmalloc_array(count, sizeof(*reqs) + sizeof(void*), GFP_KERNEL);
+    if (!reqs) return -ENOMEM;
+    if (copy_from_user(reqs, ureqs, count * sizeof(*reqs))) {
+        kfree(reqs);
+        return -EFAULT;
+    }
+
+    queued = elevator_queue_requests(reqs, (void**)(reqs + count), count);
+    if (queued >= 0 && copy_to_user(ureqs, reqs, count * sizeof(*reqs)))
+        queued = -EFAULT;
+    kfree(reqs);
+    return queued;
+}
+
+static const char* const state_names[] = {
+    [ELEVATOR_OFFLINE] = "OFFLINE",
+    [ELEVATOR_IDLE] = "IDLE",
+    [ELEVATOR_LOADING] = "LOADING",
+    [ELEVATOR_UP] = "UP",
+    [ELEVATOR_DOWN] = "DOWN",
+};
+
+static char pet_letter(int type) {
+    return bld.letters[type];
+}
+
+// Per-open state of a /proc/elevator reader. Records are the cars, one
+// line per floor from the top down, then the totals.
+struct elevator_iter
+{
+    int srcu_idx;
+    int nr_cars; // at least 1; a stopped elevator shows one offline car
+    int nr_floors; // floors shown, fixed at the header
+    struct car_snapshot snaps[MAX_CARS];
+    int total_waiting; // over the floors shown so far
+    loff_t counted; // last floor record added to total_waiting
+    // A floor with more than FLOOR_PREVIEW pets waiting is listed over
+    // several records: the snapshot first, then from the queue itself.
+    loff_t chunk; // the record from starts
+    struct floor_cursor from, next;
+    bool more; // the record just shown left pets for the next one
+    struct pet_brief preview[FLOOR_PREVIEW];
+};
+
+// The n-th floor shown has records n * ITER_CHUNKS and on, so the footer
+// follows the last floor's.
+#define ITER_CHUNK_BITS 16
+#define ITER_CHUNKS (1 << ITER_CHUNK_BITS)
+#define ITER_HEADER 0
+#define ITER_FOOTER(iter) (((loff_t)(iter)->nr_floors + 1) << ITER_CHUNK_BITS)
+#define ITER_RECORD(pos) ((int)((pos) >> ITER_CHUNK_BITS))
+#define ITER_CHUNK(pos) ((int)((pos) & (ITER_CHUNKS - 1)))
+
+static void* elevator_seq_start(struct seq_file* m, loff_t* pos) {
+    struct elevator_iter* iter = m->private;
+
+    iter->srcu_idx = srcu_read_lock(&elevator_srcu);
+    if (*pos == ITER_HEADER || !iter->nr_floors) {
+        struct elevator* all = smp_load_acquire(&cars);
+        int i;
+
+        iter->nr_floors = READ_ONCE(bld.nr_floors);
+        iter->total_waiting = 0;
+        iter->counted = ITER_HEADER;
+        iter->chunk = ITER_HEADER;
+        iter->more = false;
+        if (all) {
+            iter->nr_cars = nr_cars;
+            for (i = 0; i < iter->nr_cars; ++i)
+                read_car_snapshot(&all[i], &iter->snaps[i]);
+        } else {
+            iter->nr_cars = 1;
+            memset(&iter->snaps[0], 0, sizeof(iter->snaps[0]));
+        }
+    }
+    if (*pos > ITER_FOOTER(iter)) return NULL;
+    return pos;
+}
+
+static void* elevator_seq_next(struct seq_file* m, void* v, loff_t* pos) {
+    struct elevator_iter* iter = m->private;
+
+    if (iter->more) {
+        iter->from = iter->next;
+        ++*pos;
+    } else {
+        *pos = (loff_t)(ITER_RECORD(*pos) + 1) << ITER_CHUNK_BITS;
+    }
+    iter->more = false;
+    iter->chunk = *pos;
+    return *pos > ITER_FOOTER(iter) ? NULL : pos;
+}
+
+static void elevator_seq_stop(struct seq_file* m, void* v) {
+    struct elevator_iter* iter = m->private;
+
+    srcu_read_unlock(&elevator_srcu, iter->srcu_idx);
+}
+
+static void show_car(struct seq_file* m, struct car_snapshot* snap) {
+    int j;
+
+    seq_printf(m, "Elevator state: %s\n", state_names[snap->state]);
+    if (snap->state != ELEVATOR_OFFLINE)
+        seq_printf(m, "Current floor: %d\n", snap->current_floor);
+    else
+        seq_puts(m, "Current floor: N/A\n");
+    seq_printf(m, "Current load: %d lbs\n", snap->load);
+    seq_puts(m, "Elevator status:");
+    for (j = 0; j < snap->num_of_pets && j < ARRAY_SIZE(snap->pets); ++j)
+        seq_printf(m, " %c%d", pet_letter(snap->pets[j].type), snap->pets[j].dest);
+    seq_puts(m, "\n\n");
+}
+
+// The first record of a floor is printed from its snapshot without
+// locking, so a short queue never holds up the floor. A queue longer than
+// the snapshot goes on in records of FLOOR_PREVIEW pets more, each read
+// under the floor's lock from where the last one stopped.
+static int show_floor(struct seq_file* m, struct elevator_iter* iter, struct floor* flo, loff_t pos) {
+    unsigned int seq;
+    int count = 0, n, j;
+
+    if (ITER_CHUNK(pos)) {
+        // Read again from the start of the record if it overflowed, or
+        // by position if the file was read from somewhere else.
+        struct floor_cursor cur = { 0, ITER_CHUNK(pos) * FLOOR_PREVIEW };
+
+        if (iter->chunk == pos) cur = iter->from;
+        n = elevator_floor_pets(flo, &cur, iter->preview, FLOOR_PREVIEW, &iter->more);
+        iter->next = cur;
+    } else {
+        do {
+            seq = read_seqcount_begin(&flo->seq);
+            count = flo->snap_count;
+            n = min(flo->snap_len, FLOOR_PREVIEW);
+            memcpy(iter->preview, flo->snap_pets, n * sizeof(iter->preview[0]));
+        } while (read_seqcount_retry(&flo->seq, seq));
+        seq_printf(m, "%d", count);
+        iter->more = n < count;
+        iter->next.id = 0;
+        iter->next.at = n;
+    }
+
+    for (j = 0; j < n; ++j)
+        seq_printf(m, " %c%d", pet_letter(iter->preview[j].type), iter->preview[j].dest);
+    return count;
+}
+
+static int elevator_seq_show(struct seq_file* m, void* v) {
+    struct elevator_iter* iter = m->private;
+    loff_t pos = *(loff_t*)v;
+    int i;
+    int total_pets = 0, total_serviced = 0;
+
+    if (pos == ITER_HEADER) {
+        for (i = 0; i < iter->nr_cars; ++i) {
+            if (iter->nr_cars > 1)
+                seq_printf(m, "Car %d\n", i + 1);
+            show_car(m, &iter->snaps[i]);
+        }
+    } else if (pos == ITER_FOOTER(iter)) {
+        for (i = 0; i < iter->nr_cars; ++i) {
+            total_pets += iter->snaps[i].num_of_pets;
+            total_serviced += iter->snaps[i].pets_serviced;
+        }
+        seq_printf(m, "\nNumber of pets: %d\n", total_pets);
+        seq_printf(m, "Number of pets waiting: %d\n", iter->total_waiting);
+        seq_printf(m, "Number of pets serviced: %d\n", total_serviced);
+    } else {
+        int floor_num = iter->nr_floors - (ITER_RECORD(pos) - 1);
+        struct floor* all = smp_load_acquire(&floors);
+        struct floor* flo = NULL;
+        int waiting = 0;
+        bool here = false;
+
+        // The building may have been restarted with fewer floors since
+        // the header was read.
+        if (all && floor_num <= bld.nr_floors)
+            flo = &all[floor_num - 1];
+
+        for (i = 0; i < iter->nr_cars; ++i)
+            if (iter->snaps[i].state != ELEVATOR_OFFLINE && iter->snaps[i].current_floor == floor_num)
+                here = true;
+
+        iter->more = false;
+        if (!ITER_CHUNK(pos))
+            seq_printf(m, "[%s] Floor %d: ", here ? "*" : " ", floor_num);
+        if (flo)
+            waiting = show_floor(m, iter, flo, pos);
+        else if (!ITER_CHUNK(pos))
+            seq_putc(m, '0');
+        // Over 8M pets at one floor; the line has to end somewhere.
+        if (iter->more && ITER_CHUNK(pos) == ITER_CHUNKS - 1) {
+            seq_puts(m, " ...");
+            iter->more = false;
+        }
+        if (!iter->more)
+            seq_putc(m, '\n');
+        // show may run twice for a record that overflowed the buffer.
+        if (pos > iter->counted) {
+            iter->total_waiting += waiting;
+            iter->counted = pos;
+        }
+    }
+    return 0;
+}
+
+static const struct seq_operations elevator_seq_ops = {
+    .start = elevator_seq_start,
+    .next = elevator_seq_next,
+    .stop = elevator_seq_stop,
+    .show = elevator_seq_show,
+};
+
+static int procfile_open(struct inode* inode, struct file* file) {
+    return seq_open_private(file, &elevator_seq_ops, sizeof(struct elevator_iter));
+}
+
+static const struct proc_ops procfile_fops = {
+    .proc_open = procfile_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = seq_release_private,
+};
+
+static u64 avg_ms(u64 total_ns, u64 samples) {
+    return samples ? div64_u64(total_ns, samples * NSEC_PER_MSEC) : 0;
+}
+
+// Queue depth high-water marks of the floors that have had pets waiting.
+static void show_floor_waiting_max(struct seq_file* m) {
+    struct floor* all;
+    int srcu_idx;
+    int i;
+
+    srcu_idx = srcu_read_lock(&elevator_srcu);
+    all = smp_load_acquire(&floors);
+    if (all) {
+        seq_puts(m, "floor  waiting_max\n");
+        for (i = 0; i < bld.nr_floors; ++i)
+            if (READ_ONCE(all[i].waiting_max))
+                seq_printf(m, "%5d  %11d\n", i + 1, READ_ONCE(all[i].waiting_max));
+    }
+    srcu_read_unlock(&elevator_srcu, srcu_idx);
+}
+
+static const char* const class_names[ELEVATOR_NR_PRIO] = {
+    [ELEVATOR_PRIO_NORMAL] = "normal",
+    [ELEVATOR_PRIO_HIGH] = "high",
+};
+
+static int statsfile_show(struct seq_file* m, void* v) {
+    struct elevator_stats st;
+    u64 samples, avg_ns = 0;
+    u64 load, pets;
+    int i;
+
+    elevator_read_stats(&st);
+    samples = st.dispatch_samples;
+    if (samples) avg_ns = div64_u64(st.dispatch_total_ns, samples);
+
+    seq_printf(m, "time_scale: %d\n", st.time_scale);
+    seq_printf(m, "dispatch_samples: %llu\n", samples);
+    seq_printf(m, "dispatch_avg_us: %llu\n", div_u64(avg_ns, NSEC_PER_USEC));
+    seq_printf(m, "dispatch_max_us: %llu\n", div_u64(st.dispatch_max_ns, NSEC_PER_USEC));
+    seq_printf(m, "car_lock_hold_avg_us: %llu\n",
+               st.lock_hold_samples ? div64_u64(st.lock_hold_total_ns, st.lock_hold_samples * NSEC_PER_USEC) : 0);
+    seq_printf(m, "car_lock_hold_max_us: %llu\n", div_u64(st.lock_hold_max_ns, NSEC_PER_USEC));
+
+    // Car utilization, in tenths.
+    load = st.trips ? div64_u64(st.trip_load_total * 10, st.trips) : 0;
+    pets = st.trips ? div64_u64(st.trip_pets_total * 10, st.trips) : 0;
+    seq_printf(m, "trips: %llu\n", st.trips);
+    seq_printf(m, "trip_load_avg_lbs: %llu.%llu\n", div_u64(load, 10), load % 10);
+    seq_printf(m, "trip_load_avg_pct: %llu\n", st.max_weight ? div_u64(load * 10, st.max_weight) : 0);
+    seq_printf(m, "trip_pets_avg: %llu.%llu\n", div_u64(pets, 10), pets % 10);
+
+    seq_puts(m, "\nclass    boarded  wait_avg_ms  wait_p99_ms  wait_max_ms\n");
+    for (i = 0; i < ELEVATOR_NR_PRIO; ++i) {
+        struct class_stats* cs = &st.per_class[i];
+
+        seq_printf(m, "%-8s %7llu %12llu %12llu %12llu\n", class_names[i], cs->boarded,
+                   avg_ms(cs->wait_total_ns, cs->boarded), elevator_wait_quantile_ms(cs, 99),
+                   div_u64(cs->wait_max_ns, NSEC_PER_MSEC));
+    }
+
+    seq_printf(m, "\nmax_waiting: %d\n", st.max_waiting);
+    seq_printf(m, "max_floor_waiting: %d\n", st.max_floor_waiting);
+    seq_printf(m, "waiting: %d\n", st.waiting);
+    seq_printf(m, "waiting_max: %d\n", st.waiting_max);
+    seq_printf(m, "rejected: %llu\n", st.rejected);
+    show_floor_waiting_max(m);
+
+    seq_printf(m, "\nsched: %s\n", scheds[st.policy]->name);
+    seq_puts(m, "policy   serviced  wait_avg_ms  ride_avg_ms  pets_per_min\n");
+    for (i = 0; i < NR_POLICIES; ++i) {
+        struct sched_stats* ps = &st.per_policy[i];
+        // tenths of a pet per minute of running time
+        u64 rate = ps->active_ns ? div64_u64(ps->serviced * 600 * NSEC_PER_SEC, ps->active_ns) : 0;
+
+        seq_printf(m, "%-8s %8llu %12llu %12llu %11llu.%llu\n", scheds[i]->name, ps->serviced,
+                   avg_ms(ps->wait_total_ns, ps->boarded), avg_ms(ps->ride_total_ns, ps->serviced),
+                   div_u64(rate, 10), rate % 10);
+    }
+    return 0;
+}
+
+static int statsfile_open(struct inode* inode, struct file* file) {
+    return single_open(file, statsfile_show, NULL);
+}
+
+static const struct proc_ops statsfile_fops = {
+    .proc_open = statsfile_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+};
+
+static const char* const latency_names[NR_LAT_KINDS] = {
+    [LAT_WAIT_FROM] = "wait_from",
+    [LAT_RIDE_FROM] = "ride_from",
+    [LAT_WAIT_TO] = "wait_to",
+    [LAT_RIDE_TO] = "ride_to",
+};
+
+// One row per floor and kind that has samples: percentiles, then the
+// bucket counts (<1 ms, <2 ms, <4 ms, ...).
+static int latencyfile_show(struct seq_file* m, void* v) {
+    struct floor_latency* lat;
+    struct floor* all;
+    int srcu_idx;
+    int i, k, b;
+
+    lat = kmalloc(sizeof(*lat), GFP_KERNEL);
+    if (!lat) return -ENOMEM;
+    seq_puts(m, "floor kind         count   p50_ms   p90_ms   p99_ms  buckets\n");
+    srcu_idx = srcu_read_lock(&elevator_srcu);
+    all = smp_load_acquire(&floors);
+    for (i = 0; all && i < bld.nr_floors; ++i) {
+        elevator_read_latency(&all[i], lat);
+        for (k = 0; k < NR_LAT_KINDS; ++k) {
+            const u64* hist = lat->hist[k];
+            u64 count = 0;
+
+            for (b = 0; b < LATENCY_BUCKETS; ++b)
+                count += hist[b];
+            if (!count) continue;
+            seq_printf(m, "%5d %-9s %8llu %8llu %8llu %8llu ", i + 1, latency_names[k], count,
+                       elevator_hist_quantile_ms(hist, LATENCY_BUCKETS, 50),
+                       elevator_hist_quantile_ms(hist, LATENCY_BUCKETS, 90),
+                       elevator_hist_quantile_ms(hist, LATENCY_BUCKETS, 99));
+            for (b = 0; b < LATENCY_BUCKETS; ++b)
+                seq_printf(m, " %llu", hist[b]);
+            seq_putc(m, '\n');
+        }
+    }
+    srcu_read_unlock(&elevator_srcu, srcu_idx);
+    kfree(lat);
+    return 0;
+}
+
+static int latencyfile_open(struct inode* inode, struct file* file) {
+    return single_open(file, latencyfile_show, NULL);
+}
+
+// "reset" clears the histograms; they also start over with the elevator.
+static ssize_t latencyfile_write(struct file* file, const char __user* buf, size_t count, loff_t* ppos) {
+    char cmd[8];
+
+    if (count >= sizeof(cmd)) return -EINVAL;
+    if (copy_from_user(cmd, buf, count)) return -EFAULT;
+    cmd[count] = '\0';
+    if (!sysfs_streq(cmd, "reset")) return -EINVAL;
+    elevator_reset_latency();
+    return count;
+}
+
+static const struct proc_ops latencyfile_fops = {
+    .proc_open = latencyfile_open,
+    .proc_read = seq_read,
+    .proc_write = latencyfile_write,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+};
+
+// The event ring is mapped read-only; readers never enter the kernel per event.
+static int events_mmap(struct file* file, struct vm_area_struct* vma) {
+    unsigned long size = vma->vm_end - vma->vm_start;
+
+    if (vma->vm_flags & VM_WRITE) return -EPERM;
+    if ((vma->vm_pgoff << PAGE_SHIFT) + size > event_ring_size) return -EINVAL;
+    vm_flags_clear(vma, VM_MAYWRITE);
+    return remap_vmalloc_range(vma, event_ring, vma->vm_pgoff);
+}
+
+static const struct file_operations events_fops = {
+    .owner = THIS_MODULE,
+    .mmap = events_mmap,
+};
+
+static struct miscdevice events_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "elevator_events",
+    .fops = &events_fops,
+    .mode = 0444,
+};
+
+static ssize_t trace_read(struct file* file, char __user* buf, size_t count, loff_t* pos) {
+    return elevator_read_trace(buf, count, pos);
+}
+
+static const struct file_operations trace_fops = {
+    .owner = THIS_MODULE,
+    .read = trace_read,
+    .llseek = default_llseek,
+};
+
+static struct miscdevice trace_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "elevator_trace",
+    .fops = &trace_fops,
+    .mode = 0444,
+};
+
+// Each open file is a session with its own completion queue.
+static int requests_open(struct inode* inode, struct file* file) {
+    struct elevator_session* s = elevator_session_create();
+
+    if (!s) return -ENOMEM;
+    file->private_data = s;
+    return stream_open(inode, file);
+}
+
+static int requests_release(struct inode* inode, struct file* file) {
+    elevator_session_close(file->private_data);
+    return 0;
+}
+
+// Same limits as issue_requests, and the same single allocation for the
+// copy and the pet pointers.
+static ssize_t requests_write(struct file* file, const char __user* buf, size_t count, loff_t* pos) {
+    struct elevator_submit* subs;
+    size_t n = count / sizeof(*subs);
+    int ret;
+
+    if (!n || n > MAX_BATCH_REQUESTS || count % sizeof(*subs)) return -EINVAL;
+    subs = kmalloc_array(n, sizeof(*subs) + sizeof(void*), GFP_KERNEL);
+    if (!subs) return -ENOMEM;
+    if (copy_from_user(subs, buf, count)) {
+        kfree(subs);
+        return -EFAULT;
+    }
+    ret = elevator_session_submit(file->private_data, subs, (void**)(subs + n), n);
+    kfree(subs);
+    return ret < 0 ? ret : count;
+}
+
+#define COMPLETION_BATCH 8 // completions copied out per round, on the stack
+
+static ssize_t requests_read(struct file* file, char __user* buf, size_t count, loff_t* pos) {
+    struct elevator_session* s = file->private_data;
+    struct elevator_completion batch[COMPLETION_BATCH];
+    size_t max = count / sizeof(batch[0]);
+    size_t done = 0;
+    int n, ret;
+
+    if (!max) return -EINVAL;
+    while (done < max) {
+        n = elevator_session_read(s, batch, min_t(size_t, max - done, COMPLETION_BATCH));
+        if (!n) {
+            if (done) break;
+            if (file->f_flags & O_NONBLOCK) return -EAGAIN;
+            ret = wait_event_interruptible(s->wait, elevator_session_ready(s));
+            if (ret) return ret;
+            continue;
+        }
+        if (copy_to_user(buf + done * sizeof(batch[0]), batch, n * sizeof(batch[0])))
+            return -EFAULT;
+        done += n;
+    }
+    return done * sizeof(batch[0]);
+}
+
+static __poll_t requests_poll(struct file* file, poll_table* wait) {
+    struct elevator_session* s = file->private_data;
+
+    poll_wait(file, &s->wait, wait);
+    return EPOLLOUT | EPOLLWRNORM | (elevator_session_ready(s) ? EPOLLIN | EPOLLRDNORM : 0);
+}
+
+static const struct file_operations requests_fops = {
+    .owner = THIS_MODULE,
+    .open = requests_open,
+    .release = requests_release,
+    .read = requests_read,
+    .write = requests_write,
+    .poll = requests_poll,
+};
+
+static struct miscdevice requests_dev = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = "elevator_requests",
+    .fops = &requests_fops,
+    .mode = 0666,
+};
+
+static int __init init_elevator(void) {
+    int ret;
+
+    printk(KERN_INFO "Loading elevator module\n");
+    ret = elevator_core_init();
+    if (ret) return ret;
+    ret = misc_register(&events_dev);
+    if (ret)
+        goto err_core;
+    ret = misc_register(&trace_dev);
+    if (ret)
+        goto err_events;
+    ret = misc_register(&requests_dev);
+    if (ret)
+        goto err_trace;
+    ret = -ENOMEM;
+    proc_entry = proc_create(ENTRY_NAME,PERMS,PARENT, &procfile_fops);
+    if (proc_entry == NULL)
+        goto err_requests;
+    stats_entry = proc_create(STATS_ENTRY_NAME, PERMS, PARENT, &statsfile_fops);
+    if (stats_entry == NULL)
+        goto err_proc;
+    latency_entry = proc_create(LATENCY_ENTRY_NAME, LATENCY_PERMS, PARENT, &latencyfile_fops);
+    if (latency_entry == NULL)
+        goto err_stats;
+    STUB_start_elevator = start_elevator;
+    STUB_issue_request = issue_request;
+    STUB_issue_requests = issue_requests;
+    STUB_stop_elevator = stop_elevator;
+    return 0;
+
+err_stats:
+    proc_remove(stats_entry);
+err_proc:
+    proc_remove(proc_entry);
+err_requests:
+    misc_deregister(&requests_dev);
+err_trace:
+    misc_deregister(&trace_dev);
+err_events:
+    misc_deregister(&events_dev);
+err_core:
+    elevator_core_exit();
+    return ret;
+}
+
+static void __exit cleanup_elevator(void) {
+    stop_elevator();
+    printk(KERN_INFO "Unloading elevator module\n");
+    proc_remove(latency_entry);
+    proc_remove(stats_entry);
+    proc_remove(proc_entry);
+    printk(KERN_INFO "/proc/%s removed\n", ENTRY_NAME);
+    STUB_start_elevator = NULL;
+    STUB_issue_request = NULL;
+    STUB_issue_requests = NULL;
+    STUB_stop_elevator = NULL;
+    misc_deregister(&requests_dev);
+    misc_deregister(&trace_dev);
+    misc_deregister(&events_dev);
+    elevator_core_exit();
+}
+
+module_init(init_elevator);
+module_exit(cleanup_elevator);
+
+MODULE_AUTHOR("Logan Harmon");
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("My elevator kernel module to service pets");
+MODULE_VERSION("1.0");
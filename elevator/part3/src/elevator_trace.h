@@ -0,0 +1,154 @@
+// Tracepoints for perf and ftrace, under events/elevator/. Each one costs
+// a patched-out branch while disabled. elevator_core.c creates them; the
+// userspace build gets empty stubs.
+
+#ifndef __KERNEL__
+
+#ifndef _ELEVATOR_TRACE_H
+#define _ELEVATOR_TRACE_H
+
+static inline void trace_elevator_enqueue(u64 pet_id, int type, int floor, int dest) {}
+static inline void trace_elevator_board(int car, u64 pet_id, int type, int floor, int dest, u64 wait_ns) {}
+static inline void trace_elevator_dispense(int car, u64 pet_id, int type, int floor, u64 ride_ns) {}
+static inline void trace_elevator_move(int car, int from, int to) {}
+static inline void trace_elevator_state(int car, int floor, int state) {}
+static inline void trace_elevator_lock_contended(int floor, u64 wait_ns) {}
+static inline bool trace_elevator_lock_contended_enabled(void) { return false; }
+
+#endif
+
+#else
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM elevator
+
+#if !defined(_ELEVATOR_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ELEVATOR_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Cars are numbered from 1, as in the event ring.
+TRACE_EVENT(elevator_enqueue,
+    TP_PROTO(u64 pet_id, int type, int floor, int dest),
+    TP_ARGS(pet_id, type, floor, dest),
+    TP_STRUCT__entry(
+        __field(u64, pet_id)
+        __field(int, type)
+        __field(int, floor)
+        __field(int, dest)
+    ),
+    TP_fast_assign(
+        __entry->pet_id = pet_id;
+        __entry->type = type;
+        __entry->floor = floor;
+        __entry->dest = dest;
+    ),
+    TP_printk("pet=%llu type=%d floor=%d dest=%d",
+              __entry->pet_id, __entry->type, __entry->floor, __entry->dest)
+);
+
+TRACE_EVENT(elevator_board,
+    TP_PROTO(int car, u64 pet_id, int type, int floor, int dest, u64 wait_ns),
+    TP_ARGS(car, pet_id, type, floor, dest, wait_ns),
+    TP_STRUCT__entry(
+        __field(int, car)
+        __field(u64, pet_id)
+        __field(int, type)
+        __field(int, floor)
+        __field(int, dest)
+        __field(u64, wait_ns)
+    ),
+    TP_fast_assign(
+        __entry->car = car;
+        __entry->pet_id = pet_id;
+        __entry->type = type;
+        __entry->floor = floor;
+        __entry->dest = dest;
+        __entry->wait_ns = wait_ns;
+    ),
+    TP_printk("car=%d pet=%llu type=%d floor=%d dest=%d wait_ns=%llu",
+              __entry->car, __entry->pet_id, __entry->type, __entry->floor,
+              __entry->dest, __entry->wait_ns)
+);
+
+TRACE_EVENT(elevator_dispense,
+    TP_PROTO(int car, u64 pet_id, int type, int floor, u64 ride_ns),
+    TP_ARGS(car, pet_id, type, floor, ride_ns),
+    TP_STRUCT__entry(
+        __field(int, car)
+        __field(u64, pet_id)
+        __field(int, type)
+        __field(int, floor)
+        __field(u64, ride_ns)
+    ),
+    TP_fast_assign(
+        __entry->car = car;
+        __entry->pet_id = pet_id;
+        __entry->type = type;
+        __entry->floor = floor;
+        __entry->ride_ns = ride_ns;
+    ),
+    TP_printk("car=%d pet=%llu type=%d floor=%d ride_ns=%llu",
+              __entry->car, __entry->pet_id, __entry->type, __entry->floor, __entry->ride_ns)
+);
+
+TRACE_EVENT(elevator_move,
+    TP_PROTO(int car, int from, int to),
+    TP_ARGS(car, from, to),
+    TP_STRUCT__entry(
+        __field(int, car)
+        __field(int, from)
+        __field(int, to)
+    ),
+    TP_fast_assign(
+        __entry->car = car;
+        __entry->from = from;
+        __entry->to = to;
+    ),
+    TP_printk("car=%d from=%d to=%d", __entry->car, __entry->from, __entry->to)
+);
+
+TRACE_EVENT(elevator_state,
+    TP_PROTO(int car, int floor, int state),
+    TP_ARGS(car, floor, state),
+    TP_STRUCT__entry(
+        __field(int, car)
+        __field(int, floor)
+        __field(int, state)
+    ),
+    TP_fast_assign(
+        __entry->car = car;
+        __entry->floor = floor;
+        __entry->state = state;
+    ),
+    TP_printk("car=%d floor=%d state=%s", __entry->car, __entry->floor,
+              __print_symbolic(__entry->state,
+                               { 0, "OFFLINE" }, { 1, "IDLE" }, { 2, "LOADING" },
+                               { 3, "UP" }, { 4, "DOWN" }))
+);
+
+// A floor lock that was held when someone wanted it, and how long they
+// waited. Only timed while this event is enabled.
+TRACE_EVENT(elevator_lock_contended,
+    TP_PROTO(int floor, u64 wait_ns),
+    TP_ARGS(floor, wait_ns),
+    TP_STRUCT__entry(
+        __field(int, floor)
+        __field(u64, wait_ns)
+    ),
+    TP_fast_assign(
+        __entry->floor = floor;
+        __entry->wait_ns = wait_ns;
+    ),
+    TP_printk("floor=%d wait_ns=%llu", __entry->floor, __entry->wait_ns)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE elevator_trace
+#include <trace/define_trace.h>
+
+#endif
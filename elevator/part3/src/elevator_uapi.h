@@ -0,0 +1,133 @@
+#ifndef __ELEVATOR_UAPI_H
+#define __ELEVATOR_UAPI_H
+
+// Binary interfaces shared by the elevator module and the programs in
+// elevator-test/.
+
+#include <linux/types.h>
+
+// One entry of an issue_requests batch. status is written back by the
+// kernel: 0 = queued, 1 = invalid request, negative errno otherwise:
+// -EAGAIN when the floor or building queue limit is reached. A batch, or
+// one write(2) to ELEVATOR_REQUESTS_DEV, holds at most MAX_BATCH_REQUESTS.
+#define MAX_BATCH_REQUESTS 1024
+
+struct pet_request {
+    __s32 start_floor;
+    __s32 destination_floor;
+    __s32 type;
+    __s32 status;
+};
+
+// Requests with completion notification. Each open of
+// ELEVATOR_REQUESTS_DEV is a separate queue: write(2) an array of struct
+// elevator_submit to queue them all, or none with EINVAL if any is
+// invalid or EAGAIN if they do not all fit under the queue limits. Once
+// a pet is delivered, or dropped because the elevator stopped, the fd
+// turns readable for poll/epoll and read(2) returns one struct
+// elevator_completion per pet, blocking unless O_NONBLOCK.
+#define ELEVATOR_REQUESTS_DEV "/dev/elevator_requests"
+
+// Request classes. High priority pets board ahead of normal ones waiting
+// at the same floor, and cars head for their floors first.
+#define ELEVATOR_PRIO_NORMAL 0
+#define ELEVATOR_PRIO_HIGH 1
+#define ELEVATOR_NR_PRIO 2
+
+struct elevator_submit {
+    __u64 user_data; // returned as is in the completion
+    __s32 start_floor;
+    __s32 destination_floor;
+    __s32 type;
+    __s32 priority; // ELEVATOR_PRIO_*; requests through issue_request(s) are normal
+};
+
+struct elevator_completion {
+    __u64 user_data;
+    __u64 pet_id;  // as in the event ring
+    __u64 wait_ns; // queued until boarded, 0 if it never boarded
+    __u64 ride_ns; // boarded until delivered
+    __s32 status;  // 0 delivered, -ECANCELED if the elevator stopped first
+    __u32 pad;
+};
+
+// Event ring exported read-only through mmap of ELEVATOR_EVENTS_DEV.
+// The first page holds struct elevator_ring_header, the events start at
+// data_offset. Writers never wait for readers: a slow reader notices lost
+// events as gaps in seq.
+#define ELEVATOR_EVENTS_DEV "/dev/elevator_events"
+#define ELEVATOR_RING_MAGIC 0x454c4556 // "ELEV"
+#define ELEVATOR_RING_VERSION 1
+
+enum elevator_event_type {
+    ELEVATOR_EV_ENQUEUE = 1, // pet queued on floor, heading to dest
+    ELEVATOR_EV_BOARD,       // pet boarded the car at floor
+    ELEVATOR_EV_DISPENSE,    // pet left the car at floor
+    ELEVATOR_EV_ARRIVE,      // car reached floor
+    ELEVATOR_EV_STATE,       // car changed to state at floor
+};
+
+// Car states, as in ELEVATOR_EV_STATE and /proc/elevator.
+enum elevator_state {
+    ELEVATOR_OFFLINE = 0, // stopped
+    ELEVATOR_IDLE,        // nothing to do; waiting, or parked, for the next request
+    ELEVATOR_LOADING,     // doors open
+    ELEVATOR_UP,
+    ELEVATOR_DOWN,
+};
+
+struct elevator_event {
+    __u64 seq;     // position in the ring, starting at 1; written last
+    __u64 time_ns; // simulated time, which runs time_scale times real time
+    __u64 pet_id;  // 0 for car events
+    __u8 type;     // enum elevator_event_type
+    __u8 pet_type;
+    __u8 state;    // enum elevator_state, for ELEVATOR_EV_STATE
+    __u8 car;      // car number from 1, 0 for ELEVATOR_EV_ENQUEUE
+    __u16 floor;
+    __u16 dest;
+};
+
+struct elevator_ring_header {
+    __u32 magic;
+    __u32 version;
+    __u32 nr_events;  // power of two
+    __u32 event_size; // sizeof(struct elevator_event)
+    __u64 data_offset;
+    __u64 head;       // seq of the most recently reserved event
+};
+
+// A slot is valid for position pos when its seq equals pos. Readers copy
+// the event and then re-check seq; a changed seq means it was overwritten.
+static inline struct elevator_event *elevator_ring_slot(struct elevator_ring_header *hdr, __u64 pos) {
+    struct elevator_event *events = (struct elevator_event *)((char *)hdr + hdr->data_offset);
+
+    return &events[pos & (hdr->nr_events - 1)];
+}
+
+// Recorded requests, read(2) from ELEVATOR_TRACE_DEV while the record
+// parameter is or was set: struct elevator_trace_header, then nr_records
+// records in arrival order, time_ns never going back. Only requests that
+// were valid for the running building are recorded. Replaying the records
+// at their time_ns offsets reproduces the arrival stream.
+#define ELEVATOR_TRACE_DEV "/dev/elevator_trace"
+#define ELEVATOR_TRACE_MAGIC 0x54564c45 // "ELVT"
+#define ELEVATOR_TRACE_VERSION 1
+
+struct elevator_trace_header {
+    __u32 magic;
+    __u32 version;
+    __u32 record_size; // sizeof(struct elevator_trace_record)
+    __u32 nr_records;
+    __u64 dropped;     // requests that arrived after the buffer filled up
+};
+
+struct elevator_trace_record {
+    __u64 time_ns; // simulated time of arrival
+    __u16 start_floor;
+    __u16 destination_floor;
+    __u8 type;
+    __u8 pad[3];
+};
+
+#endif
@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../elevator_core.h"
+#include "../elevator-test/ring.h"
+
+// Runs the elevator core in-process against a workload and reports what
+// /proc/elevator_stats would. With the default virtual clock the whole
+// run goes at CPU speed and is deterministic: the same workload gives the
+// same service order, and so the same service_order digest, every run.
+
+struct sim_options {
+	int pets;
+	int cars;
+	int scale;
+	int async;
+	int high_pct; // percent of pets sent as high priority, through a session
+	unsigned int seed;
+	const char *policy;
+	const char *workload;
+	const char *replay;
+	const char *record;
+	char types[128];
+	struct building bld;
+};
+
+void usage(void) {
+	printf("usage: elevator-sim [-n pets] [-c cars] [-f floors] [-k capacity] [-w max_weight]\n"
+	       "                    [-t pet_types] [-p policy] [-x time_scale] [-s seed] [-i workload]\n"
+	       "                    [-q max_floor_waiting] [-Q max_waiting] [-b board_fill] [-g board_age_ms]\n"
+	       "                    [-P high_pct] [-A prio_age_ms] [-d park] [-r trace] [-R trace] [-a] [-v]\n");
+}
+
+double now_sec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Uniformly random pets, as producer sends them.
+int random_workload(struct sim_options *opt, struct pet_request **out) {
+	struct pet_request *reqs = calloc(opt->pets, sizeof(*reqs));
+	int i;
+
+	if (!reqs)
+		return -1;
+	for (i = 0; i < opt->pets; i += 1) {
+		reqs[i].type = rand_r(&opt->seed) % opt->bld.nr_types;
+		reqs[i].start_floor = rand_r(&opt->seed) % opt->bld.nr_floors + 1;
+		do {
+			reqs[i].destination_floor = rand_r(&opt->seed) % opt->bld.nr_floors + 1;
+		} while (reqs[i].destination_floor == reqs[i].start_floor);
+	}
+	*out = reqs;
+	return opt->pets;
+}
+
+// One "start dest type" request per line; blank lines and lines starting
+// with # are skipped.
+int read_workload(const char *path, struct pet_request **out) {
+	FILE *f = fopen(path, "r");
+	struct pet_request *reqs = NULL;
+	char line[256];
+	int n = 0, cap = 0;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		struct pet_request req = { 0 };
+
+		if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+		if (sscanf(line, "%d %d %d", &req.start_floor, &req.destination_floor, &req.type) != 3) {
+			printf("%s: bad request: %s", path, line);
+			n = -1;
+			break;
+		}
+		if (n == cap) {
+			struct pet_request *grown;
+
+			cap = cap ? cap * 2 : 1024;
+			grown = realloc(reqs, cap * sizeof(*reqs));
+			if (!grown) {
+				n = -1;
+				break;
+			}
+			reqs = grown;
+		}
+		reqs[n++] = req;
+	}
+	fclose(f);
+	if (n < 0)
+		free(reqs);
+	else
+		*out = reqs;
+	return n;
+}
+
+// Arrivals from a file recorded by the module's record parameter or by -R,
+// as offsets from the earliest one, which need not come first.
+int read_trace(const char *path, struct pet_request **out, ktime_t **out_at) {
+	struct elevator_trace_header hdr;
+	struct elevator_trace_record rec;
+	struct pet_request *reqs;
+	ktime_t *at;
+	FILE *f = fopen(path, "rb");
+	__u64 first = 0;
+	__u32 i, k;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != ELEVATOR_TRACE_MAGIC ||
+	    hdr.version != ELEVATOR_TRACE_VERSION || hdr.record_size != sizeof(rec)) {
+		printf("%s: not an elevator trace\n", path);
+		fclose(f);
+		return -1;
+	}
+	if (hdr.dropped)
+		printf("%s: %llu requests were dropped while recording\n", path, (unsigned long long)hdr.dropped);
+	reqs = calloc(hdr.nr_records ? hdr.nr_records : 1, sizeof(*reqs));
+	at = calloc(hdr.nr_records ? hdr.nr_records : 1, sizeof(*at));
+	if (!reqs || !at) {
+		free(reqs);
+		free(at);
+		fclose(f);
+		return -1;
+	}
+	for (i = 0; i < hdr.nr_records && fread(&rec, sizeof(rec), 1, f) == 1; i += 1) {
+		reqs[i].start_floor = rec.start_floor;
+		reqs[i].destination_floor = rec.destination_floor;
+		reqs[i].type = rec.type;
+		at[i] = rec.time_ns;
+		if (!i || rec.time_ns < first)
+			first = rec.time_ns;
+	}
+	fclose(f);
+	for (k = 0; k < i; k += 1)
+		at[k] = (ktime_t)((__u64)at[k] - first);
+	*out = reqs;
+	*out_at = at;
+	return i;
+}
+
+int write_trace(const char *path) {
+	char buf[1 << 16];
+	loff_t pos = 0;
+	ssize_t n;
+	FILE *f = fopen(path, "wb");
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	while ((n = elevator_read_trace(buf, sizeof(buf), &pos)) > 0)
+		fwrite(buf, 1, n, f);
+	return fclose(f) || n < 0 ? -1 : 0;
+}
+
+// Follows the event ring. digest is FNV-1a over every boarding and
+// dispense, so two runs served the pets in the same order, by the same
+// cars, at the same times exactly when their digests match.
+struct follower {
+	__u64 start; // times are hashed relative to the start of the run
+	__u64 pos;
+	__u64 lost;
+	__u64 digest;
+	__u64 last_dispense;
+};
+
+void hash_bytes(__u64 *h, const void *p, size_t n) {
+	const unsigned char *c = p;
+
+	while (n--) {
+		*h ^= *c++;
+		*h *= 0x100000001b3ULL;
+	}
+}
+
+// With the virtual clock held nothing else writes to the ring, so this
+// sees every event up to the present.
+void drain_ring(struct follower *f) {
+	struct elevator_event ev;
+	__u64 t;
+	int ret;
+
+	while ((ret = read_event(event_ring, f->pos + 1, &ev)) != 0) {
+		f->pos += 1;
+		if (ret < 0) {
+			f->lost += 1;
+			continue;
+		}
+		if (ev.type != ELEVATOR_EV_BOARD && ev.type != ELEVATOR_EV_DISPENSE)
+			continue;
+		t = ev.time_ns - f->start;
+		hash_bytes(&f->digest, &t, sizeof(t));
+		hash_bytes(&f->digest, &ev.pet_id, sizeof(ev.pet_id));
+		hash_bytes(&f->digest, &ev.type, sizeof(ev.type));
+		hash_bytes(&f->digest, &ev.car, sizeof(ev.car));
+		hash_bytes(&f->digest, &ev.floor, sizeof(ev.floor));
+		if (ev.type == ELEVATOR_EV_DISPENSE)
+			f->last_dispense = t;
+	}
+}
+
+// Through a session with -a, where an invalid request or a full queue
+// fails its whole batch. Returns the number queued.
+int queue_batch(struct sim_options *opt, struct elevator_session *session, struct pet_request *reqs,
+		int first, void **scratch, int n) {
+	struct elevator_submit subs[MAX_BATCH_REQUESTS];
+	int i, ret;
+
+	if (!session)
+		return elevator_queue_requests(reqs + first, scratch, n);
+	for (i = 0; i < n; i += 1) {
+		subs[i].user_data = first + i;
+		subs[i].start_floor = reqs[first + i].start_floor;
+		subs[i].destination_floor = reqs[first + i].destination_floor;
+		subs[i].type = reqs[first + i].type;
+		subs[i].priority = rand_r(&opt->seed) % 100 < opt->high_pct ? ELEVATOR_PRIO_HIGH : ELEVATOR_PRIO_NORMAL;
+	}
+	ret = elevator_session_submit(session, subs, scratch, n);
+	return ret == -EINVAL || ret == -EAGAIN ? 0 : ret;
+}
+
+// Delivered pets read back from the session.
+long read_completions(struct elevator_session *session) {
+	struct elevator_completion c[64];
+	long delivered = 0;
+	int n, i;
+
+	while ((n = elevator_session_read(session, c, 64)) > 0)
+		for (i = 0; i < n; i += 1)
+			delivered += c[i].status == 0;
+	return delivered;
+}
+
+u64 total_serviced(void) {
+	struct elevator_stats st;
+	u64 serviced = 0;
+	int i;
+
+	elevator_read_stats(&st);
+	for (i = 0; i < NR_POLICIES; i += 1)
+		serviced += st.per_policy[i].serviced;
+	return serviced;
+}
+
+// The highest p99 of one latency kind over the floors, and its floor.
+u64 worst_floor_p99(enum latency_kind kind, int *floor) {
+	struct floor_latency lat;
+	struct floor *all;
+	u64 worst = 0;
+	int srcu_idx;
+	int i;
+
+	*floor = 0;
+	srcu_idx = srcu_read_lock(&elevator_srcu);
+	all = smp_load_acquire(&floors);
+	for (i = 0; all && i < bld.nr_floors; i += 1) {
+		u64 ms;
+
+		elevator_read_latency(&all[i], &lat);
+		ms = elevator_hist_quantile_ms(lat.hist[kind], LATENCY_BUCKETS, 99);
+		if (ms > worst) {
+			worst = ms;
+			*floor = i + 1;
+		}
+	}
+	srcu_read_unlock(&elevator_srcu, srcu_idx);
+	return worst;
+}
+
+// Submit the requests at their arrival times, or all at once without at,
+// then wait for the last pet to get off.
+int run(struct sim_options *opt, struct pet_request *reqs, ktime_t *at, int count) {
+	void *scratch[MAX_BATCH_REQUESTS];
+	struct follower f = { .digest = 0xcbf29ce484222325ULL };
+	struct elevator_session *session = NULL;
+	struct elevator_stats st;
+	struct sched_stats *ps;
+	u64 wait_p99, ride_p99;
+	int wait_floor, ride_floor;
+	long rejected = 0;
+	long completed = 0;
+	int queued = 0;
+	double wall_start, wall;
+	ktime_t sim_start, sim;
+	int ret;
+	int i, j;
+
+	ret = elevator_start(&opt->bld, opt->cars, opt->scale);
+	if (ret) {
+		printf("elevator_start failed: %d\n", ret);
+		return -1;
+	}
+	if (opt->record && elevator_record(count)) {
+		printf("cannot record %d requests\n", count);
+		elevator_stop();
+		return -1;
+	}
+	if (opt->async && !(session = elevator_session_create())) {
+		elevator_stop();
+		return -1;
+	}
+
+	// The cars may already be writing events.
+	f.pos = READ_ONCE(event_ring->head);
+	wall_start = now_sec();
+	sim_start = elevator_now();
+	f.start = sim_start;
+	for (i = 0; i < count; i = j) {
+		ktime_t t = at ? at[i] : 0;
+
+		// Everything due at one instant is queued with the clock held.
+		// Holding it from one wait to the next also keeps the cars from
+		// running past the next arrival.
+		elevator_clock_wait(sim_start + t);
+		for (j = i; j < count && (!at || at[j] == t);) {
+			int n = 0;
+
+			while (j + n < count && n < MAX_BATCH_REQUESTS && (!at || at[j + n] == t))
+				n += 1;
+			ret = queue_batch(opt, session, reqs, j, scratch, n);
+			if (ret < 0) {
+				printf("queueing failed: %d\n", ret);
+				elevator_clock_release();
+				elevator_stop();
+				return -1;
+			}
+			queued += ret;
+			rejected += n - ret;
+			j += n;
+		}
+		drain_ring(&f);
+	}
+	while (session ? completed < queued : total_serviced() < (u64)queued) {
+		elevator_clock_wait(elevator_now() + NSEC_PER_SEC);
+		drain_ring(&f);
+		if (session)
+			completed += read_completions(session);
+	}
+	elevator_clock_release();
+	drain_ring(&f);
+	sim = f.last_dispense;
+	wall = now_sec() - wall_start;
+	elevator_read_stats(&st);
+	wait_p99 = worst_floor_p99(LAT_WAIT_FROM, &wait_floor);
+	ride_p99 = worst_floor_p99(LAT_RIDE_TO, &ride_floor);
+	elevator_stop();
+	if (session)
+		elevator_session_close(session);
+	if (opt->record) {
+		elevator_record(0);
+		if (write_trace(opt->record))
+			printf("%s: write failed\n", opt->record);
+	}
+
+	ps = &st.per_policy[st.policy];
+	printf("policy: %s\n", scheds[st.policy]->name);
+	printf("cars: %d\n", opt->cars);
+	printf("floors: %d\n", opt->bld.nr_floors);
+	printf("time_scale: %d\n", opt->scale);
+	printf("pets: %d\n", queued);
+	printf("rejected: %ld\n", rejected);
+	printf("rejected_full: %llu\n", (unsigned long long)st.rejected);
+	printf("waiting_max: %d\n", st.waiting_max);
+	printf("sim_time: %.3f s\n", sim / 1e9);
+	printf("wall_time: %.6f s\n", wall);
+	printf("wait_avg: %.3f s\n", ps->boarded ? ps->wait_total_ns / 1e9 / ps->boarded : 0);
+	printf("wait_max: %.3f s\n", st.dispatch_max_ns / 1e9);
+	printf("ride_avg: %.3f s\n", ps->serviced ? ps->ride_total_ns / 1e9 / ps->serviced : 0);
+	printf("pets_per_min: %.1f\n", sim > 0 ? queued * 60e9 / sim : 0);
+	for (i = 0; i < ELEVATOR_NR_PRIO; i += 1) {
+		struct class_stats *cs = &st.per_class[i];
+		const char *name = i == ELEVATOR_PRIO_HIGH ? "high" : "normal";
+
+		printf("%s_pets: %llu\n", name, (unsigned long long)cs->boarded);
+		printf("%s_wait_avg: %.3f s\n", name, cs->boarded ? cs->wait_total_ns / 1e9 / cs->boarded : 0);
+		printf("%s_wait_p99: %.3f s\n", name, elevator_wait_quantile_ms(cs, 99) / 1e3);
+	}
+	printf("floor_wait_p99_max: %.3f s (floor %d)\n", wait_p99 / 1e3, wait_floor);
+	printf("floor_ride_p99_max: %.3f s (floor %d)\n", ride_p99 / 1e3, ride_floor);
+	printf("lock_hold_avg: %.3f us\n", st.lock_hold_samples ? st.lock_hold_total_ns / 1e3 / st.lock_hold_samples : 0);
+	printf("lock_hold_max: %.3f us\n", st.lock_hold_max_ns / 1e3);
+	printf("trips: %llu\n", (unsigned long long)st.trips);
+	printf("trip_load_avg: %.1f lbs (%.0f%%)\n", st.trips ? (double)st.trip_load_total / st.trips : 0,
+	       st.trips ? 100.0 * st.trip_load_total / st.trips / st.max_weight : 0);
+	printf("trip_pets_avg: %.1f\n", st.trips ? (double)st.trip_pets_total / st.trips : 0);
+	if (session)
+		printf("completions: %ld\n", completed);
+	printf("service_order: %016llx\n", (unsigned long long)f.digest);
+	printf("events_lost: %llu\n", (unsigned long long)f.lost);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	struct sim_options opt = {
+		.pets = 1000,
+		.cars = 1,
+		.scale = 0,
+		.seed = 1,
+		.policy = "look",
+		.types = "C:3,P:14,H:10,D:16",
+		.bld = { .nr_floors = 5, .capacity = 5, .max_weight = 50, .board_fill = true, .board_age_ms = 120000,
+			 .prio_age_ms = 60000, .park = true },
+	};
+	struct pet_request *reqs;
+	ktime_t *at = NULL;
+	int count;
+	int ret;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:c:f:k:w:t:p:x:s:i:q:Q:b:g:P:A:d:r:R:avh")) != -1) {
+		switch (c) {
+		case 'n': opt.pets = atoi(optarg); break;
+		case 'c': opt.cars = atoi(optarg); break;
+		case 'f': opt.bld.nr_floors = atoi(optarg); break;
+		case 'k': opt.bld.capacity = atoi(optarg); break;
+		case 'w': opt.bld.max_weight = atoi(optarg); break;
+		case 't': snprintf(opt.types, sizeof(opt.types), "%s", optarg); break;
+		case 'p': opt.policy = optarg; break;
+		case 'x': opt.scale = atoi(optarg); break;
+		case 's': opt.seed = strtoul(optarg, NULL, 0); break;
+		case 'i': opt.workload = optarg; break;
+		case 'q': opt.bld.max_floor_waiting = atoi(optarg); break;
+		case 'Q': opt.bld.max_waiting = atoi(optarg); break;
+		case 'b': opt.bld.board_fill = atoi(optarg); break;
+		case 'g': opt.bld.board_age_ms = atoi(optarg); break;
+		case 'P': opt.high_pct = atoi(optarg); opt.async = 1; break;
+		case 'A': opt.bld.prio_age_ms = atoi(optarg); break;
+		case 'd': opt.bld.park = atoi(optarg); break;
+		case 'r': opt.replay = optarg; break;
+		case 'R': opt.record = optarg; break;
+		case 'a': opt.async = 1; break;
+		case 'v': elevator_set_debug(true); break;
+		default:
+			usage();
+			return c == 'h' ? 0 : -1;
+		}
+	}
+	if (optind != argc || opt.pets < 1) {
+		usage();
+		return -1;
+	}
+	if (elevator_parse_pet_types(&opt.bld, opt.types) || elevator_check_building(&opt.bld)) {
+		printf("invalid building\n");
+		return -1;
+	}
+
+	if (elevator_core_init()) {
+		printf("out of memory\n");
+		return -1;
+	}
+	if (elevator_set_policy(opt.policy)) {
+		printf("unknown policy %s\n", opt.policy);
+		return -1;
+	}
+
+	if (opt.replay)
+		count = read_trace(opt.replay, &reqs, &at);
+	else if (opt.workload)
+		count = read_workload(opt.workload, &reqs);
+	else
+		count = random_workload(&opt, &reqs);
+	if (count < 0)
+		return -1;
+
+	ret = run(&opt, reqs, at, count);
+	free(reqs);
+	free(at);
+	elevator_core_exit();
+	return ret;
+}
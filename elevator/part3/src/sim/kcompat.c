@@ -0,0 +1,387 @@
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <time.h>
+#include "kcompat.h"
+
+ktime_t ktime_get(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ktime_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+void fsleep(unsigned long usecs) {
+    struct timespec ts = { usecs / 1000000, (usecs % 1000000) * 1000 };
+
+    while (nanosleep(&ts, &ts) && errno == EINTR)
+        ;
+}
+
+unsigned long* bitmap_zalloc(unsigned int nbits, int flags) {
+    return calloc(BITS_TO_LONGS(nbits), sizeof(unsigned long));
+}
+
+void bitmap_free(const unsigned long* bitmap) {
+    free((void*)bitmap);
+}
+
+void bitmap_zero(unsigned long* dst, unsigned int nbits) {
+    unsigned int i;
+
+    for (i = 0; i < BITS_TO_LONGS(nbits); ++i)
+        WRITE_ONCE(dst[i], 0);
+}
+
+void bitmap_copy(unsigned long* dst, const unsigned long* src, unsigned int nbits) {
+    unsigned int i;
+
+    for (i = 0; i < BITS_TO_LONGS(nbits); ++i)
+        WRITE_ONCE(dst[i], READ_ONCE(src[i]));
+}
+
+void bitmap_or(unsigned long* dst, const unsigned long* a, const unsigned long* b, unsigned int nbits) {
+    unsigned int i;
+
+    for (i = 0; i < BITS_TO_LONGS(nbits); ++i)
+        WRITE_ONCE(dst[i], READ_ONCE(a[i]) | READ_ONCE(b[i]));
+}
+
+// Bits past nbits are always clear, as in the kernel's allocators.
+bool bitmap_empty(const unsigned long* src, unsigned int nbits) {
+    unsigned int i;
+
+    for (i = 0; i < BITS_TO_LONGS(nbits); ++i)
+        if (READ_ONCE(src[i])) return false;
+    return true;
+}
+
+unsigned long find_next_bit(const unsigned long* addr, unsigned long size, unsigned long offset) {
+    unsigned long word;
+
+    if (offset >= size) return size;
+    word = READ_ONCE(addr[BIT_WORD(offset)]) & (~0UL << (offset % BITS_PER_LONG));
+    offset -= offset % BITS_PER_LONG;
+    while (!word) {
+        offset += BITS_PER_LONG;
+        if (offset >= size) return size;
+        word = READ_ONCE(addr[BIT_WORD(offset)]);
+    }
+    offset += __builtin_ctzl(word);
+    return offset < size ? offset : size;
+}
+
+unsigned long find_last_bit(const unsigned long* addr, unsigned long size) {
+    unsigned long idx = BITS_TO_LONGS(size);
+
+    while (idx--) {
+        unsigned long word = READ_ONCE(addr[idx]);
+
+        if (idx == BIT_WORD(size) && size % BITS_PER_LONG)
+            word &= BIT_MASK(size) - 1;
+        if (word)
+            return idx * BITS_PER_LONG + BITS_PER_LONG - 1 - __builtin_clzl(word);
+    }
+    return size;
+}
+
+void* vmalloc_user(size_t size) {
+    void* p = aligned_alloc(PAGE_SIZE, (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+
+    if (p) memset(p, 0, size);
+    return p;
+}
+
+struct kmem_cache* kmem_cache_create(const char* name, unsigned int size, unsigned int align,
+                                     unsigned long flags, void (*ctor)(void*)) {
+    struct kmem_cache* cache = malloc(sizeof(*cache));
+
+    if (!cache) return NULL;
+    cache->name = name;
+    cache->size = size;
+    return cache;
+}
+
+void kmem_cache_destroy(struct kmem_cache* cache) {
+    free(cache);
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache, int flags) {
+    return malloc(cache->size);
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* obj) {
+    free(obj);
+}
+
+// All or nothing, like the kernel's.
+int kmem_cache_alloc_bulk(struct kmem_cache* cache, int flags, size_t n, void** objs) {
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        objs[i] = malloc(cache->size);
+        if (!objs[i]) {
+            kmem_cache_free_bulk(cache, i, objs);
+            return 0;
+        }
+    }
+    return n;
+}
+
+void kmem_cache_free_bulk(struct kmem_cache* cache, size_t n, void** objs) {
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        free(objs[i]);
+}
+
+char* strim(char* s) {
+    char* end = s + strlen(s);
+
+    while (end > s && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+    while (isspace((unsigned char)*s))
+        s++;
+    return s;
+}
+
+int kstrtoint(const char* s, unsigned int base, int* res) {
+    char* end;
+    long val;
+
+    errno = 0;
+    val = strtol(s, &end, base);
+    if (end == s) return -EINVAL;
+    if (*end == '\n') end++;
+    if (*end) return -EINVAL;
+    if (errno || val < INT_MIN || val > INT_MAX) return -ERANGE;
+    *res = val;
+    return 0;
+}
+
+// Equal, ignoring one trailing newline on either side.
+bool sysfs_streq(const char* s1, const char* s2) {
+    while (*s1 && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+    if (*s1 == *s2) return true;
+    if (!*s1 && *s2 == '\n' && !s2[1]) return true;
+    if (*s1 == '\n' && !s1[1] && !*s2) return true;
+    return false;
+}
+
+void init_waitqueue_head(wait_queue_head_t* wq) {
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+}
+
+void wake_up_all(wait_queue_head_t* wq) {
+    pthread_mutex_lock(&wq->lock);
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+}
+
+static void* worker_main(void* arg) {
+    struct workqueue_struct* wq = arg;
+
+    pthread_mutex_lock(&wq->lock);
+    while (!wq->stop) {
+        struct work_struct* work = NULL;
+        struct work_struct* w;
+
+        // Items that are still running elsewhere wait their turn.
+        list_for_each_entry(w, &wq->pending, entry) {
+            if (!w->running) {
+                work = w;
+                break;
+            }
+        }
+        if (!work) {
+            pthread_cond_wait(&wq->cond, &wq->lock);
+            continue;
+        }
+        list_del_init(&work->entry);
+        work->pending = false;
+        work->running = true;
+        pthread_mutex_unlock(&wq->lock);
+        work->func(work);
+        pthread_mutex_lock(&wq->lock);
+        work->running = false;
+        pthread_cond_broadcast(&wq->cond);
+    }
+    pthread_mutex_unlock(&wq->lock);
+    return NULL;
+}
+
+struct workqueue_struct* alloc_workqueue(const char* name, unsigned int flags, int max_active) {
+    struct workqueue_struct* wq = calloc(1, sizeof(*wq));
+    int i;
+
+    if (!wq) return NULL;
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->cond, NULL);
+    INIT_LIST_HEAD(&wq->pending);
+    for (i = 0; i < WQ_SIM_WORKERS; ++i) {
+        if (pthread_create(&wq->workers[i], NULL, worker_main, wq)) {
+            wq->stop = true;
+            while (i--)
+                pthread_join(wq->workers[i], NULL);
+            free(wq);
+            return NULL;
+        }
+        pthread_setname_np(wq->workers[i], name);
+    }
+    return wq;
+}
+
+// Nothing may be queued any more.
+void destroy_workqueue(struct workqueue_struct* wq) {
+    int i;
+
+    pthread_mutex_lock(&wq->lock);
+    wq->stop = true;
+    pthread_cond_broadcast(&wq->cond);
+    pthread_mutex_unlock(&wq->lock);
+    for (i = 0; i < WQ_SIM_WORKERS; ++i)
+        pthread_join(wq->workers[i], NULL);
+    free(wq);
+}
+
+bool queue_work(struct workqueue_struct* wq, struct work_struct* work) {
+    bool queued = false;
+
+    pthread_mutex_lock(&wq->lock);
+    work->wq = wq;
+    if (!work->pending) {
+        work->pending = true;
+        list_add_tail(&work->entry, &wq->pending);
+        pthread_cond_signal(&wq->cond);
+        queued = true;
+    }
+    pthread_mutex_unlock(&wq->lock);
+    return queued;
+}
+
+bool cancel_work_sync(struct work_struct* work) {
+    struct workqueue_struct* wq = work->wq;
+    bool was_pending;
+
+    if (!wq) return false;
+    pthread_mutex_lock(&wq->lock);
+    was_pending = work->pending;
+    if (was_pending) {
+        list_del_init(&work->entry);
+        work->pending = false;
+    }
+    while (work->running)
+        pthread_cond_wait(&wq->cond, &wq->lock);
+    pthread_mutex_unlock(&wq->lock);
+    return was_pending;
+}
+
+bool flush_work(struct work_struct* work) {
+    struct workqueue_struct* wq = work->wq;
+    bool waited = false;
+
+    if (!wq) return false;
+    pthread_mutex_lock(&wq->lock);
+    while (work->pending || work->running) {
+        waited = true;
+        pthread_cond_wait(&wq->cond, &wq->lock);
+    }
+    pthread_mutex_unlock(&wq->lock);
+    return waited;
+}
+
+// The timer thread is started by the first hrtimer_start and lives as
+// long as the process.
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+static LIST_HEAD(timers_armed);
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+
+static void* timer_main(void* arg) {
+    pthread_mutex_lock(&timer_lock);
+    for (;;) {
+        struct hrtimer* first = NULL;
+        struct hrtimer* t;
+        struct timespec ts;
+
+        list_for_each_entry(t, &timers_armed, entry)
+            if (!first || t->expires < first->expires)
+                first = t;
+        if (!first) {
+            pthread_cond_wait(&timer_cond, &timer_lock);
+            continue;
+        }
+        if (first->expires > ktime_get()) {
+            ts.tv_sec = first->expires / NSEC_PER_SEC;
+            ts.tv_nsec = first->expires % NSEC_PER_SEC;
+            pthread_cond_timedwait(&timer_cond, &timer_lock, &ts);
+            continue;
+        }
+        list_del_init(&first->entry);
+        first->queued = false;
+        first->running = true;
+        pthread_mutex_unlock(&timer_lock);
+        first->function(first);
+        pthread_mutex_lock(&timer_lock);
+        first->running = false;
+        pthread_cond_broadcast(&timer_cond);
+    }
+    return NULL;
+}
+
+static void timer_start_thread(void) {
+    pthread_condattr_t attr;
+    pthread_t tid;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&tid, NULL, timer_main, NULL)) {
+        fprintf(stderr, "cannot start the timer thread\n");
+        abort();
+    }
+    pthread_setname_np(tid, "hrtimer");
+    pthread_detach(tid);
+}
+
+void hrtimer_setup(struct hrtimer* timer, enum hrtimer_restart (*function)(struct hrtimer*),
+                   clockid_t clock_id, enum hrtimer_mode mode) {
+    INIT_LIST_HEAD(&timer->entry);
+    timer->function = function;
+    timer->queued = false;
+    timer->running = false;
+}
+
+// Callbacks always return HRTIMER_NORESTART here.
+void hrtimer_start(struct hrtimer* timer, ktime_t delay, enum hrtimer_mode mode) {
+    pthread_once(&timer_once, timer_start_thread);
+    pthread_mutex_lock(&timer_lock);
+    timer->expires = ktime_get() + delay;
+    if (!timer->queued) {
+        timer->queued = true;
+        list_add_tail(&timer->entry, &timers_armed);
+    }
+    pthread_cond_broadcast(&timer_cond);
+    pthread_mutex_unlock(&timer_lock);
+}
+
+int hrtimer_cancel(struct hrtimer* timer) {
+    int was_queued;
+
+    pthread_once(&timer_once, timer_start_thread);
+    pthread_mutex_lock(&timer_lock);
+    was_queued = timer->queued;
+    if (was_queued) {
+        list_del_init(&timer->entry);
+        timer->queued = false;
+    }
+    while (timer->running)
+        pthread_cond_wait(&timer_cond, &timer_lock);
+    pthread_mutex_unlock(&timer_lock);
+    return was_queued;
+}
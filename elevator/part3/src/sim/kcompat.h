@@ -0,0 +1,509 @@
+#ifndef __KCOMPAT_H
+#define __KCOMPAT_H
+
+// Just enough of the kernel API for elevator_core.c to build in userspace.
+// Locks and wait queues are pthreads, work queues and timers are served by
+// their own pthreads, the slab and
+// vmalloc are malloc, and SRCU is a reader-writer lock. The marked
+// accessors and bitops are __atomic builtins, so sanitizers see the same
+// races the kernel code relies on being benign.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <linux/types.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef __loff_t loff_t;
+
+#define __user
+#define __init
+#define __exit
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BUILD_BUG_ON(cond) _Static_assert(!(cond), #cond)
+#define min(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a < _b ? _a : _b; })
+#define max(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a > _b ? _a : _b; })
+#define min_t(type, a, b) min((type)(a), (type)(b))
+#define max_t(type, a, b) max((type)(a), (type)(b))
+#define U32_MAX UINT32_MAX
+#define container_of(ptr, type, member) ((type*)((char*)(ptr) - offsetof(type, member)))
+
+#define KERN_ERR ""
+#define KERN_INFO ""
+#define KERN_NOTICE ""
+#define KERN_DEBUG ""
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+
+#define MAX_ERRNO 4095
+#define IS_ERR(ptr) ((unsigned long)(ptr) >= (unsigned long)-MAX_ERRNO)
+#define ERR_PTR(err) ((void*)(long)(err))
+#define PTR_ERR(ptr) ((long)(ptr))
+
+// Static keys are plain flags.
+struct static_key_false
+{
+    bool enabled;
+};
+#define DEFINE_STATIC_KEY_FALSE(name) struct static_key_false name = { false }
+#define static_branch_unlikely(key) __builtin_expect(__atomic_load_n(&(key)->enabled, __ATOMIC_RELAXED), 0)
+#define static_branch_enable(key) __atomic_store_n(&(key)->enabled, true, __ATOMIC_RELAXED)
+#define static_branch_disable(key) __atomic_store_n(&(key)->enabled, false, __ATOMIC_RELAXED)
+
+// Memory ordering
+
+#define READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, val) __atomic_store_n(&(x), (val), __ATOMIC_RELAXED)
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, val) __atomic_store_n(p, (val), __ATOMIC_RELEASE)
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+typedef struct { int counter; } atomic_t;
+typedef struct { s64 counter; } atomic64_t;
+#define ATOMIC_INIT(i) { (i) }
+#define ATOMIC64_INIT(i) { (i) }
+#define atomic_read(v) __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic_set(v, i) __atomic_store_n(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic_add(i, v) ((void)__atomic_fetch_add(&(v)->counter, (i), __ATOMIC_RELAXED))
+#define atomic_sub(i, v) ((void)__atomic_fetch_sub(&(v)->counter, (i), __ATOMIC_RELAXED))
+#define atomic_inc(v) atomic_add(1, v)
+#define atomic_dec(v) atomic_sub(1, v)
+#define atomic_inc_return(v) __atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+#define atomic_try_cmpxchg(v, old, new) \
+    __atomic_compare_exchange_n(&(v)->counter, (old), (new), false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)
+#define atomic_xchg(v, i) __atomic_exchange_n(&(v)->counter, (i), __ATOMIC_SEQ_CST)
+#define atomic_dec_and_test(v) (__atomic_sub_fetch(&(v)->counter, 1, __ATOMIC_ACQ_REL) == 0)
+#define atomic64_read(v) __atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic64_set(v, i) __atomic_store_n(&(v)->counter, (i), __ATOMIC_RELAXED)
+#define atomic64_add(i, v) ((void)__atomic_fetch_add(&(v)->counter, (i), __ATOMIC_RELAXED))
+#define atomic64_inc(v) atomic64_add(1, v)
+#define atomic64_inc_return(v) __atomic_add_fetch(&(v)->counter, 1, __ATOMIC_SEQ_CST)
+
+// Time
+
+typedef s64 ktime_t;
+#define KTIME_MAX INT64_MAX
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define NSEC_PER_SEC 1000000000L
+#define USEC_PER_MSEC 1000L
+
+ktime_t ktime_get(void);
+void fsleep(unsigned long usecs);
+// Every run starts at midnight, so runs that depend on the time of day
+// still repeat exactly.
+#define ktime_get_real_seconds() ((s64)0)
+#define ktime_add(a, b) ((a) + (b))
+#define ktime_sub(a, b) ((a) - (b))
+#define ktime_add_ms(k, ms) ((k) + (s64)(ms) * NSEC_PER_MSEC)
+#define ms_to_ktime(ms) ((s64)(ms) * NSEC_PER_MSEC)
+#define ktime_add_ns(k, ns) ((k) + (s64)(ns))
+#define ktime_to_ns(k) ((s64)(k))
+#define ktime_to_us(k) ((s64)(k) / NSEC_PER_USEC)
+#define ktime_before(a, b) ((a) < (b))
+#define ktime_after(a, b) ((a) > (b))
+#define div_u64(a, b) ((u64)(a) / (u32)(b))
+#define ilog2(n) (63 - __builtin_clzll(n))
+#define div64_u64(a, b) ((u64)(a) / (u64)(b))
+static inline u64 div_u64_rem(u64 a, u32 b, u32* rem) {
+    *rem = a % b;
+    return a / b;
+}
+
+// Lists
+
+struct list_head {
+    struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name) { &(name), &(name) }
+#define LIST_HEAD(name) struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head* list) {
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void __list_add(struct list_head* entry, struct list_head* prev, struct list_head* next) {
+    next->prev = entry;
+    entry->next = next;
+    entry->prev = prev;
+    prev->next = entry;
+}
+
+static inline void list_add(struct list_head* entry, struct list_head* head) {
+    __list_add(entry, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head* entry, struct list_head* head) {
+    __list_add(entry, head->prev, head);
+}
+
+static inline void list_del(struct list_head* entry) {
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    entry->next = NULL;
+    entry->prev = NULL;
+}
+
+static inline void list_del_init(struct list_head* entry) {
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    INIT_LIST_HEAD(entry);
+}
+
+static inline void list_move(struct list_head* entry, struct list_head* head) {
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    list_add(entry, head);
+}
+
+static inline void list_move_tail(struct list_head* entry, struct list_head* head) {
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    list_add_tail(entry, head);
+}
+
+static inline bool list_empty(const struct list_head* head) {
+    return READ_ONCE(head->next) == head;
+}
+
+static inline void __list_splice(struct list_head* list, struct list_head* prev, struct list_head* next) {
+    struct list_head* first = list->next;
+    struct list_head* last = list->prev;
+
+    first->prev = prev;
+    prev->next = first;
+    last->next = next;
+    next->prev = last;
+}
+
+static inline void list_splice_init(struct list_head* list, struct list_head* head) {
+    if (list_empty(list)) return;
+    __list_splice(list, head, head->next);
+    INIT_LIST_HEAD(list);
+}
+
+static inline void list_splice_tail_init(struct list_head* list, struct list_head* head) {
+    if (list_empty(list)) return;
+    __list_splice(list, head->prev, head);
+    INIT_LIST_HEAD(list);
+}
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_first_entry(head, type, member) list_entry((head)->next, type, member)
+#define list_last_entry(head, type, member) list_entry((head)->prev, type, member)
+#define list_first_entry_or_null(head, type, member) \
+    (list_empty(head) ? NULL : list_first_entry(head, type, member))
+#define list_next_entry(pos, member) list_entry((pos)->member.next, __typeof__(*(pos)), member)
+#define list_for_each_entry(pos, head, member) \
+    for (pos = list_first_entry(head, __typeof__(*pos), member); &pos->member != (head); \
+         pos = list_next_entry(pos, member))
+#define list_for_each_entry_continue(pos, head, member) \
+    for (pos = list_next_entry(pos, member); &pos->member != (head); pos = list_next_entry(pos, member))
+#define list_for_each_entry_safe(pos, n, head, member) \
+    for (pos = list_first_entry(head, __typeof__(*pos), member), n = list_next_entry(pos, member); \
+         &pos->member != (head); pos = n, n = list_next_entry(n, member))
+
+// Bitmaps
+
+#define BITS_PER_LONG (8 * sizeof(long))
+#define BITS_TO_LONGS(nr) (((nr) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define BIT_WORD(nr) ((nr) / BITS_PER_LONG)
+#define BIT_MASK(nr) (1UL << ((nr) % BITS_PER_LONG))
+
+static inline void set_bit(long nr, unsigned long* addr) {
+    __atomic_fetch_or(&addr[BIT_WORD(nr)], BIT_MASK(nr), __ATOMIC_RELAXED);
+}
+
+static inline void clear_bit(long nr, unsigned long* addr) {
+    __atomic_fetch_and(&addr[BIT_WORD(nr)], ~BIT_MASK(nr), __ATOMIC_RELAXED);
+}
+
+// The kernel's non-atomic variants, still single-copy atomic stores.
+static inline void __set_bit(long nr, unsigned long* addr) {
+    WRITE_ONCE(addr[BIT_WORD(nr)], READ_ONCE(addr[BIT_WORD(nr)]) | BIT_MASK(nr));
+}
+
+static inline void __clear_bit(long nr, unsigned long* addr) {
+    WRITE_ONCE(addr[BIT_WORD(nr)], READ_ONCE(addr[BIT_WORD(nr)]) & ~BIT_MASK(nr));
+}
+
+static inline bool test_bit(long nr, const unsigned long* addr) {
+    return (READ_ONCE(addr[BIT_WORD(nr)]) & BIT_MASK(nr)) != 0;
+}
+
+#define hweight_long(w) __builtin_popcountl(w)
+
+unsigned long* bitmap_zalloc(unsigned int nbits, int flags);
+void bitmap_free(const unsigned long* bitmap);
+void bitmap_zero(unsigned long* dst, unsigned int nbits);
+void bitmap_copy(unsigned long* dst, const unsigned long* src, unsigned int nbits);
+void bitmap_or(unsigned long* dst, const unsigned long* a, const unsigned long* b, unsigned int nbits);
+bool bitmap_empty(const unsigned long* src, unsigned int nbits);
+unsigned long find_next_bit(const unsigned long* addr, unsigned long size, unsigned long offset);
+unsigned long find_last_bit(const unsigned long* addr, unsigned long size);
+#define find_first_bit(addr, size) find_next_bit(addr, size, 0)
+#define for_each_set_bit(bit, addr, size) \
+    for ((bit) = find_first_bit(addr, size); (bit) < (size); (bit) = find_next_bit(addr, size, (bit) + 1))
+
+static inline unsigned long rounddown_pow_of_two(unsigned long n) {
+    return 1UL << (BITS_PER_LONG - 1 - __builtin_clzl(n));
+}
+
+// Memory
+
+#define GFP_KERNEL 0
+#define PAGE_SIZE 4096UL
+#define SLAB_HWCACHE_ALIGN 0x1
+
+#define kmalloc(size, flags) malloc(size)
+#define kzalloc(size, flags) calloc(1, size)
+#define kcalloc(n, size, flags) calloc(n, size)
+#define kvcalloc(n, size, flags) calloc(n, size)
+#define kvzalloc(size, flags) calloc(1, size)
+#define kfree(p) free(p)
+#define kvfree(p) free(p)
+#define vfree(p) free(p)
+
+static inline void* kmalloc_array(size_t n, size_t size, int flags) {
+    if (size && n > SIZE_MAX / size) return NULL;
+    return malloc(n * size);
+}
+
+void* vmalloc_user(size_t size);
+
+#define struct_size(p, member, n) (sizeof(*(p)) + sizeof((p)->member[0]) * (size_t)(n))
+
+// Per-CPU data
+
+// One copy, shared by every thread.
+#define __percpu
+#define alloc_percpu(type) ((type*)calloc(1, sizeof(type)))
+#define free_percpu(p) free(p)
+#define per_cpu_ptr(p, cpu) ((void)(cpu), (p))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_inc(x) __atomic_add_fetch(&(x), 1, __ATOMIC_RELAXED)
+
+// There is only one address space.
+static inline unsigned long copy_to_user(void* to, const void* from, unsigned long n) {
+    memcpy(to, from, n);
+    return 0;
+}
+
+struct kmem_cache
+{
+    const char* name;
+    size_t size;
+};
+
+struct kmem_cache* kmem_cache_create(const char* name, unsigned int size, unsigned int align,
+                                     unsigned long flags, void (*ctor)(void*));
+void kmem_cache_destroy(struct kmem_cache* cache);
+void* kmem_cache_alloc(struct kmem_cache* cache, int flags);
+void kmem_cache_free(struct kmem_cache* cache, void* obj);
+int kmem_cache_alloc_bulk(struct kmem_cache* cache, int flags, size_t n, void** objs);
+void kmem_cache_free_bulk(struct kmem_cache* cache, size_t n, void** objs);
+
+// Strings
+
+#define strscpy(dst, src, size) ((void)snprintf(dst, size, "%s", src))
+char* strim(char* s);
+int kstrtoint(const char* s, unsigned int base, int* res);
+bool sysfs_streq(const char* s1, const char* s2);
+
+#define sort(base, num, size, cmp, swap) qsort(base, num, size, cmp)
+
+// Locks
+
+struct mutex
+{
+    pthread_mutex_t m;
+};
+#define DEFINE_MUTEX(name) struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(lock) pthread_mutex_init(&(lock)->m, NULL)
+#define mutex_lock(lock) pthread_mutex_lock(&(lock)->m)
+#define mutex_unlock(lock) pthread_mutex_unlock(&(lock)->m)
+#define mutex_trylock(lock) (pthread_mutex_trylock(&(lock)->m) == 0)
+
+typedef struct
+{
+    pthread_mutex_t m;
+} spinlock_t;
+#define DEFINE_SPINLOCK(name) spinlock_t name = { PTHREAD_MUTEX_INITIALIZER }
+#define spin_lock_init(lock) pthread_mutex_init(&(lock)->m, NULL)
+#define spin_lock(lock) pthread_mutex_lock(&(lock)->m)
+#define spin_unlock(lock) pthread_mutex_unlock(&(lock)->m)
+
+// Writers are serialized by the associated mutex, so only the count is kept.
+typedef struct
+{
+    unsigned int sequence;
+} seqcount_mutex_t;
+#define seqcount_mutex_init(s, lock) ((s)->sequence = 0)
+
+static inline void write_seqcount_begin(seqcount_mutex_t* s) {
+    WRITE_ONCE(s->sequence, s->sequence + 1);
+    smp_wmb();
+}
+
+static inline void write_seqcount_end(seqcount_mutex_t* s) {
+    smp_wmb();
+    WRITE_ONCE(s->sequence, s->sequence + 1);
+}
+
+static inline unsigned int read_seqcount_begin(const seqcount_mutex_t* s) {
+    unsigned int seq;
+
+    while ((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1)
+        ;
+    return seq;
+}
+
+static inline bool read_seqcount_retry(const seqcount_mutex_t* s, unsigned int seq) {
+    smp_rmb();
+    return READ_ONCE(s->sequence) != seq;
+}
+
+// Readers never wait for each other; synchronize_srcu waits until every
+// reader that was inside has left.
+struct srcu_struct
+{
+    pthread_rwlock_t lock;
+};
+#define DEFINE_SRCU(name) struct srcu_struct name = { PTHREAD_RWLOCK_INITIALIZER }
+#define DEFINE_STATIC_SRCU(name) static DEFINE_SRCU(name)
+
+static inline int srcu_read_lock(struct srcu_struct* ssp) {
+    pthread_rwlock_rdlock(&ssp->lock);
+    return 0;
+}
+
+static inline void srcu_read_unlock(struct srcu_struct* ssp, int idx) {
+    pthread_rwlock_unlock(&ssp->lock);
+}
+
+static inline void synchronize_srcu(struct srcu_struct* ssp) {
+    pthread_rwlock_wrlock(&ssp->lock);
+    pthread_rwlock_unlock(&ssp->lock);
+}
+
+// Wait queues and threads
+
+// Sleepers check their condition under lock, and every wake-up takes it,
+// so a condition set before the wake-up is never missed.
+typedef struct wait_queue_head
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} wait_queue_head_t;
+
+#define __WAIT_QUEUE_HEAD_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER }
+#define DECLARE_WAIT_QUEUE_HEAD(name) wait_queue_head_t name = __WAIT_QUEUE_HEAD_INITIALIZER
+
+void init_waitqueue_head(wait_queue_head_t* wq);
+void wake_up_all(wait_queue_head_t* wq);
+#define wake_up(wq) wake_up_all(wq)
+#define wake_up_interruptible(wq) wake_up_all(wq)
+#define wake_up_interruptible_all(wq) wake_up_all(wq)
+
+// Without a list of sleepers there is nothing cheaper to check first.
+static inline bool wq_has_sleeper(wait_queue_head_t* wq) {
+    return true;
+}
+
+#define wait_event_interruptible(wq, condition) ({                      \
+    wait_queue_head_t* __wq = &(wq);                                    \
+    pthread_mutex_lock(&__wq->lock);                                    \
+    while (!(condition))                                                \
+        pthread_cond_wait(&__wq->cond, &__wq->lock);                    \
+    pthread_mutex_unlock(&__wq->lock);                                  \
+    0;                                                                  \
+})
+#define wait_event(wq, condition) ((void)wait_event_interruptible(wq, condition))
+
+// Work queues
+
+// A few workers share one list of pending items. As in the kernel, an
+// item is on the list at most once and never runs on two workers at a
+// time; queueing it while it runs makes it run again afterwards.
+#define WQ_UNBOUND 0x2
+#define WQ_SIM_WORKERS 2
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct* work);
+struct work_struct
+{
+    struct list_head entry;
+    work_func_t func;
+    struct workqueue_struct* wq; // where it was last queued
+    bool pending; // under the queue's lock, as is running
+    bool running;
+};
+
+struct workqueue_struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct list_head pending;
+    bool stop;
+    pthread_t workers[WQ_SIM_WORKERS];
+};
+
+#define INIT_WORK(w, fn) do {           \
+        INIT_LIST_HEAD(&(w)->entry);    \
+        (w)->func = (fn);               \
+        (w)->wq = NULL;                 \
+        (w)->pending = false;           \
+        (w)->running = false;           \
+    } while (0)
+
+struct workqueue_struct* alloc_workqueue(const char* name, unsigned int flags, int max_active);
+void destroy_workqueue(struct workqueue_struct* wq);
+bool queue_work(struct workqueue_struct* wq, struct work_struct* work);
+bool cancel_work_sync(struct work_struct* work);
+bool flush_work(struct work_struct* work);
+
+// High resolution timers, all on one thread that runs their callbacks.
+
+enum hrtimer_restart {
+    HRTIMER_NORESTART,
+    HRTIMER_RESTART,
+};
+enum hrtimer_mode {
+    HRTIMER_MODE_REL,
+};
+
+struct hrtimer
+{
+    struct list_head entry; // on the armed list while queued
+    ktime_t expires; // ktime_get() time
+    enum hrtimer_restart (*function)(struct hrtimer* timer);
+    bool queued; // under the timer thread's lock, as is running
+    bool running;
+};
+
+#define ns_to_ktime(ns) ((ktime_t)(ns))
+
+void hrtimer_setup(struct hrtimer* timer, enum hrtimer_restart (*function)(struct hrtimer*),
+                   clockid_t clock_id, enum hrtimer_mode mode);
+void hrtimer_start(struct hrtimer* timer, ktime_t delay, enum hrtimer_mode mode);
+int hrtimer_cancel(struct hrtimer* timer);
+
+#endif